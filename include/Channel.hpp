@@ -4,30 +4,60 @@
 #include <string>
 #include <vector>
 #include <set>
+#include <ctime>
+#include <tr1/unordered_map>
 #include "Client.hpp"
+#include "Pool.hpp"
+
+// Per-member channel status
+enum {
+    MEMBER_OP = 1,
+    MEMBER_VOICE = 2
+};
+
+struct Member {
+    Client* client;
+    int flags;
+};
 
 class Channel {
 private:
     std::string name;
     std::string topic;
     std::string password;
-    std::vector<Client*> clients;
-    std::set<Client*> operators;
+    
+    // Dense member array for broadcast, indexed by client for O(1) lookups
+    std::vector<Member> members;
+    std::tr1::unordered_map<Client*, size_t> memberIndex;
     std::set<Client*> invited;
     bool inviteOnly;
     bool topicRestricted;
     int userLimit;
+    time_t created;     // decides whose settings win when two servers link
+    
+    // Rendered NAMES list split to fit `namesWidth` bytes per reply;
+    // a width of 0 marks it stale
+    std::vector<std::string> namesChunks;
+    size_t namesWidth;
+    
+    Member* lookupMember(Client* client);
     
 public:
     Channel(const std::string& name, Client* creator);
     ~Channel();
     
+    // Allocated from a per-thread slab pool
+    static void* operator new(size_t size);
+    static void operator delete(void* p, size_t size);
+    
     // Getters
     const std::string& getName() const;
     const std::string& getTopic() const;
     const std::string& getPassword() const;
-    const std::vector<Client*>& getClients() const;
+    const std::vector<Member>& getMembers() const;
+    size_t getMemberCount() const;
     int getUserLimit() const;
+    time_t getCreated() const;
     
     // Setters
     void setTopic(const std::string& topic);
@@ -35,21 +65,28 @@ public:
     void setInviteOnly(bool inviteOnly);
     void setTopicRestricted(bool restricted);
     void setUserLimit(int limit);
+    void setCreated(time_t created);
     
     // Client management
     void addClient(Client* client);
     void removeClient(Client* client);
     bool hasClient(Client* client) const;
     
-    // Operator management
+    // One lookup for membership and status; NULL when not a member
+    const Member* findMember(Client* client) const;
+    
+    // Operator and voice management
     void addOperator(Client* client);
     void removeOperator(Client* client);
     bool isOperator(Client* client) const;
+    void setVoice(Client* client, bool voice);
+    bool isVoiced(Client* client) const;
     
     // Invite management
     void addInvited(Client* client);
     void removeInvited(Client* client);
     bool isInvited(Client* client) const;
+    const std::set<Client*>& getInvited() const;
     
     // Mode flags
     bool isInviteOnly() const;
@@ -57,6 +94,11 @@ public:
     bool hasPassword() const;
     bool hasUserLimit() const;
     
+    // NAMES list as space-separated "@nick"/"+nick" chunks of at most `width`
+    // bytes, cached until membership, status or a member's nickname changes
+    const std::vector<std::string>& getNames(size_t width);
+    void invalidateNames();
+    
     // Messaging
     void broadcast(const std::string& message, Client* exclude);
 };
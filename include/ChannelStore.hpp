@@ -0,0 +1,87 @@
+#ifndef CHANNELSTORE_HPP
+#define CHANNELSTORE_HPP
+
+#include <string>
+#include <vector>
+#include <tr1/unordered_map>
+#include <pthread.h>
+
+// Saved mode bits
+enum {
+    STATE_INVITE_ONLY = 1,
+    STATE_TOPIC_RESTRICTED = 2
+};
+
+// The settings of a channel that outlive its members
+struct ChannelState {
+    std::string topic;
+    std::string key;
+    int limit;
+    int modes;
+    
+    ChannelState();
+    
+    // Nothing worth keeping: the store drops such channels
+    bool isEmpty() const;
+};
+
+// Channel settings persisted in an append-only journal. The file starts
+// with a versioned header followed by checksummed records, each one the
+// full state of a channel or its removal; the last record for a name wins.
+// save() only queues the record: a background thread appends, fdatasyncs,
+// and rewrites the file from the live records once old ones dominate it.
+class ChannelStore {
+private:
+    typedef std::tr1::unordered_map<std::string, ChannelState> StateMap;
+    
+    struct Entry {
+        std::string record;
+        size_t live;            // saved channels once this record applies
+    };
+    
+    std::string path;
+    StateMap states;            // command thread
+    
+    // Handed from save() to the writer under `lock`
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t idle;
+    std::vector<Entry> queue;
+    bool writing;
+    bool stopping;
+    pthread_t thread;
+    bool started;
+    
+    // Writer thread only, after open()
+    int fd;
+    size_t fileBytes;
+    size_t fileRecords;
+    size_t liveRecords;
+    bool broken;                // a failed append could not be cut off; no more appends
+    
+    void load();
+    void write(std::vector<Entry>& batch);
+    void compact();
+    static void* writerMain(void* arg);
+    
+    ChannelStore(const ChannelStore&);
+    ChannelStore& operator=(const ChannelStore&);
+    
+public:
+    ChannelStore();
+    ~ChannelStore();
+    
+    // Loads `path`, creating it when missing, and starts the writer.
+    // Throws std::runtime_error for unreadable or foreign files.
+    void open(const std::string& path);
+    bool isOpen() const;
+    
+    const ChannelState* find(const std::string& name) const;
+    void save(const std::string& name, const ChannelState& state);
+    size_t size() const;
+    
+    // Blocks until every save() so far is on disk
+    void flush();
+};
+
+#endif
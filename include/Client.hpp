@@ -2,7 +2,32 @@
 #define CLIENT_HPP
 
 #include <string>
-#include <vector>
+#include <deque>
+#include <set>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "Payload.hpp"
+#include "LineBuffer.hpp"
+#include "Pool.hpp"
+#include "TokenBucket.hpp"
+#include "TimerWheel.hpp"
+
+class Client;
+class Channel;
+class TlsSession;
+
+// Implemented by the reactor that owns the client's socket
+class Transport {
+public:
+    virtual ~Transport() {}
+    
+    // Command thread: hand output or a close request to the socket's owner
+    virtual void deliver(Client* client, Payload* payload) = 0;
+    virtual void disconnect(Client* client, const std::string& reason) = 0;
+    
+    // Socket thread: the client has output to flush
+    virtual void scheduleFlush(Client* client) = 0;
+};
 
 class Client {
 private:
@@ -11,22 +36,62 @@ private:
     std::string nickname;
     std::string username;
     std::string realname;
+    std::string prefix;     // ":nick!user@host", rebuilt when a part changes
     bool authenticated;
     bool passOk;
-    std::string buffer;
+    bool detached;
+    bool oper;
+    bool serverLink;    // a peer server's connection rather than a user
+    Client* route;      // remote users: the server link they are reached through
+    std::set<Channel*> channels;
+    std::set<Channel*> invites;   // channels holding an invite for this client
+    LineBuffer input;
+    
+    void rebuildPrefix();
+    
+    // Outbound queue, drained when the socket is writable.
+    // Everything below is only touched by the thread owning the socket.
+    Transport* transport;
+    TlsSession* tls;    // owned; NULL on plaintext connections
+    std::deque<Payload*> sendQueue;
+    size_t sendOffset;
+    size_t sendQueueBytes;
+    size_t sendQueueLimit;
+    bool flushScheduled;
+    bool waitingWritable;
+    bool closing;
+    bool closed;
+    std::string closeReason;
+    TokenBucket floodBucket;
+    bool throttled;     // input lines wait for the flood bucket to refill
+    Timer keepalive;    // registration deadline, then PING and ping timeout
+    unsigned long long lastInput;   // monotonic ms
+    unsigned long long pingSent;    // monotonic ms, 0 while no PING is unanswered
+    
+    bool flushTls();
     
 public:
-    Client(int fd, const std::string& ip);
+    Client(int fd, const std::string& ip, Transport* transport = NULL, size_t sendQueueLimit = 0);
     ~Client();
     
+    // Allocated from a per-thread slab pool
+    static void* operator new(size_t size);
+    static void operator delete(void* p, size_t size);
+    
     // Getters
     int getFd() const;
     const std::string& getIp() const;
     const std::string& getNickname() const;
     const std::string& getUsername() const;
     const std::string& getRealname() const;
+    const std::string& getPrefix() const;
     bool isAuthenticated() const;
     bool isPassOk() const;
+    bool isDetached() const;
+    bool isOper() const;
+    bool isServerLink() const;
+    bool isRemote() const;
+    Client* getRoute() const;
     
     // Setters
     void setNickname(const std::string& nickname);
@@ -34,10 +99,68 @@ public:
     void setRealname(const std::string& realname);
     void setAuthenticated(bool authenticated);
     void setPassOk(bool passOk);
+    void setDetached(bool detached);
+    void setOper(bool oper);
+    void setServerLink(bool serverLink);
+    void setRoute(Client* route);
+    
+    // Joined channels, maintained by Channel::addClient/removeClient
+    void addChannel(Channel* channel);
+    void removeChannel(Channel* channel);
+    const std::set<Channel*>& getChannels() const;
+    
+    // Pending invites, maintained by Channel::addInvited/removeInvited
+    void addInvite(Channel* channel);
+    void removeInvite(Channel* channel);
+    const std::set<Channel*>& getInvites() const;
     
     // Buffer management
-    void appendBuffer(const std::string& data);
-    std::vector<std::string> getCompletedCommands();
+    LineBuffer& getInput();
+    TokenBucket& getFloodBucket();
+    bool isThrottled() const;
+    void setThrottled(bool throttled);
+    
+    // Keepalive state on the socket thread
+    Timer& getKeepalive();
+    unsigned long long getLastInput() const;
+    void setLastInput(unsigned long long ms);
+    unsigned long long getPingSent() const;
+    void setPingSent(unsigned long long ms);
+    
+    // TLS connections: the client owns the session once set
+    TlsSession* getTls() const;
+    void setTls(TlsSession* tls);
+    
+    // recv() semantics over the socket or the TLS session
+    ssize_t receive(char* buffer, size_t size);
+    
+    // Output, called from the command thread
+    void queueMessage(Payload* payload);
+    void queueMessage(const std::string& line);
+    void disconnect(const std::string& reason);
+    
+    // Output management on the socket thread
+    void appendOutput(Payload* payload);
+    bool flushSendQueue();
+    bool hasPendingOutput() const;
+    
+    // For a loop that writes itself: the queued fragments as iovecs, and
+    // dropping what it reports written
+    int gatherOutput(struct iovec* iov, int max) const;
+    void consumeOutput(size_t sent);
+    void getPendingOutput(std::string& out) const;
+    size_t getSendQueueBytes() const;
+    bool isFlushScheduled() const;
+    void setFlushScheduled(bool scheduled);
+    bool isWaitingWritable() const;
+    void setWaitingWritable(bool waiting);
+    
+    // Deferred disconnect, handled by the owner on its next flush pass
+    void markClosing(const std::string& reason);
+    bool isClosing() const;
+    bool isClosed() const;
+    void setClosed();
+    const std::string& getCloseReason() const;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,32 @@
+#ifndef CLIENTTABLE_HPP
+#define CLIENTTABLE_HPP
+
+#include <vector>
+#include <cstddef>
+
+class Client;
+
+// Clients indexed directly by fd. The kernel hands out the lowest free
+// descriptor, so the table stays dense and a lookup is one bounds check
+// and one load.
+class ClientTable {
+private:
+    std::vector<Client*> slots;
+    size_t count;
+    
+public:
+    ClientTable();
+    
+    Client* find(int fd) const {
+        return (fd >= 0 && static_cast<size_t>(fd) < slots.size()) ? slots[fd] : NULL;
+    }
+    
+    void insert(int fd, Client* client);
+    void erase(int fd);
+    size_t size() const;
+    
+    // Iterate with: for (int fd = 0; fd < table.limit(); ++fd) if (table.find(fd)) ...
+    int limit() const;
+};
+
+#endif
@@ -3,7 +3,9 @@
 
 #include <string>
 #include <vector>
+#include "MessageView.hpp"
 
+// Owning copy of a parsed line for the command handlers
 class Command {
 private:
     std::string command;
@@ -12,6 +14,7 @@ private:
     
 public:
     Command(const std::string& raw);
+    Command(const MessageView& message);
     ~Command();
     
     const std::string& getCommand() const;
@@ -19,4 +22,4 @@ public:
     const std::string& getPrefix() const;
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,47 @@
+#ifndef CONFIG_HPP
+#define CONFIG_HPP
+
+#include <string>
+#include <vector>
+#include "Logger.hpp"
+
+// Tunables passed as --name=value after <port> <password>
+struct ServerConfig {
+    std::string backend;
+    size_t sendQueueLimit;  // bytes queued per client before it is dropped
+    int threads;            // reactor threads, each with its own listening socket
+    Logger::Level logLevel;
+    std::string operPassword;   // OPER is refused while empty
+    std::string statsSocket;    // Unix socket path for metrics dumps, off when empty
+    std::string stateFile;      // journal of channel topics, keys and modes, off when empty
+    size_t maxTargets;          // TARGMAX for PRIVMSG and KICK
+    size_t floodBurst;          // line-cost units a client may send back to back
+    size_t floodRate;           // units refilled per second; 0 turns flood control off
+    size_t pingInterval;        // idle seconds before the server sends PING; 0 disables
+    size_t pingTimeout;         // seconds to answer it
+    size_t registrationTimeout; // seconds to complete PASS/NICK/USER; 0 disables
+    
+    // Server links: peers authenticate with `linkPassword`, which also
+    // enables accepting them; `connectTo` lists host:port peers to dial
+    std::string serverName;
+    std::string linkPassword;
+    std::vector<std::string> connectTo;
+    
+    // Second port speaking TLS, off while 0; the key may sit in the cert file
+    int tlsPort;
+    std::string tlsCert;
+    std::string tlsKey;
+    
+    // Live upgrade: the command line to exec, and the handoff socket the
+    // previous process passed (-1 on a normal start)
+    std::vector<std::string> arguments;
+    int upgradeFd;
+    
+    ServerConfig();
+    
+    // Returns false for unknown options or invalid values
+    bool parseOption(const std::string& arg);
+    bool parseThreads(const std::string& value);
+};
+
+#endif
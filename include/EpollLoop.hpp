@@ -0,0 +1,25 @@
+#ifndef EPOLLLOOP_HPP
+#define EPOLLLOOP_HPP
+
+#include <vector>
+#include <sys/epoll.h>
+#include "EventLoop.hpp"
+
+class EpollLoop : public EventLoop {
+private:
+    int epollFd;
+    std::vector<epoll_event> readyEvents;
+    
+public:
+    EpollLoop();
+    ~EpollLoop();
+    
+    bool add(int fd, int events);
+    bool modify(int fd, int events);
+    void remove(int fd);
+    int wait(std::vector<IoEvent>& events, int timeoutMs);
+    bool isEdgeTriggered() const;
+    const char* getName() const;
+};
+
+#endif
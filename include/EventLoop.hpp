@@ -0,0 +1,47 @@
+#ifndef EVENTLOOP_HPP
+#define EVENTLOOP_HPP
+
+#include <string>
+#include <vector>
+
+// Readiness flags shared by every backend, then the completions of I/O
+// that a completion-based backend (UringLoop) performed itself
+enum {
+    EVENT_READ = 1,
+    EVENT_WRITE = 2,
+    EVENT_ERROR = 4,
+    EVENT_ACCEPTED = 8,     // result: the new socket or -errno; fd: the listener
+    EVENT_RECEIVED = 16,    // result: byte count, 0 at end of stream, or -errno
+    EVENT_SENT = 32         // result: byte count or -errno
+};
+
+struct IoEvent {
+    int fd;
+    int events;
+    int result;
+    const char* data;       // EVENT_RECEIVED bytes, valid until the next wait()
+};
+
+class EventLoop {
+public:
+    virtual ~EventLoop();
+    
+    // Interest management
+    virtual bool add(int fd, int events) = 0;
+    virtual bool modify(int fd, int events) = 0;
+    virtual void remove(int fd) = 0;
+    
+    // Fills `events` with ready fds only; returns -1 on error
+    virtual int wait(std::vector<IoEvent>& events, int timeoutMs) = 0;
+    
+    // Edge-triggered backends only report transitions, so callers must
+    // drain accept()/recv() until EAGAIN
+    virtual bool isEdgeTriggered() const = 0;
+    virtual const char* getName() const = 0;
+    
+    // Returns the requested backend, falling back to epoll when io_uring is
+    // unavailable and to poll when epoll is
+    static EventLoop* create(const std::string& backend);
+};
+
+#endif
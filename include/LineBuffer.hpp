@@ -0,0 +1,53 @@
+#ifndef LINEBUFFER_HPP
+#define LINEBUFFER_HPP
+
+#include <cstddef>
+#include "MessageView.hpp"
+
+// Fixed-capacity receive buffer with single-pass CR/LF framing. The socket
+// is read straight into it and complete lines come out as views, so nothing
+// is copied between recv() and the parser. Storage is only held while data
+// is buffered, which keeps idle connections free.
+class LineBuffer {
+public:
+    static const size_t CAPACITY = 8192;
+    static const size_t MAX_LINE = 512;            // RFC 1459, CRLF included
+    static const size_t MAX_TAGGED_LINE = 4096 + 512;  // IRCv3 client tag budget
+    
+    enum Status {
+        NO_LINE,
+        LINE,
+        LINE_TOO_LONG
+    };
+    
+private:
+    char* data;
+    size_t start;       // first byte of the current line
+    size_t end;         // end of received data
+    size_t scan;        // bytes before this are known to contain no '\n'
+    bool discarding;    // dropping the rest of an overlong line
+    
+    LineBuffer(const LineBuffer&);
+    LineBuffer& operator=(const LineBuffer&);
+    
+public:
+    LineBuffer();
+    ~LineBuffer();
+    
+    // Room for the next recv(); at least MAX_LINE bytes as long as lines are
+    // taken out as they arrive, 0 once unread lines fill the buffer
+    char* prepareWrite(size_t& room);
+    void commit(size_t count);
+    
+    // The view stays valid until the next prepareWrite() or release()
+    Status nextLine(StringRef& line);
+    
+    // Everything received and not yet taken out as a line
+    StringRef buffered() const;
+    
+    // Frees storage when no partial line is pending
+    void release();
+    size_t size() const;
+};
+
+#endif
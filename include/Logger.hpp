@@ -0,0 +1,99 @@
+#ifndef LOGGER_HPP
+#define LOGGER_HPP
+
+#include <string>
+#include <cstddef>
+#include <pthread.h>
+#include "MessageView.hpp"
+
+// Levelled logging through a bounded lock-free ring. Any thread formats its
+// line into a slot without allocating or locking; a background thread
+// batches the slots into one write() per stream. When the ring is full
+// lines are dropped and counted rather than stalling the caller.
+class Logger {
+public:
+    enum Level {
+        LEVEL_DEBUG,
+        LEVEL_INFO,
+        LEVEL_WARN,
+        LEVEL_ERROR
+    };
+    
+    static const size_t MAX_MESSAGE = 240;
+    
+    // Starts the writer thread; lines logged before start() are written directly
+    static void start(Level threshold);
+    static void shutdown();
+    
+    static bool isEnabled(Level level) { return level >= threshold; }
+    static bool parseLevel(const std::string& name, Level& level);
+    
+    static void commit(Level level, const char* text, size_t length);
+    
+private:
+    struct Slot {
+        size_t sequence;
+        Level level;
+        long seconds;
+        long millis;
+        size_t length;
+        char text[MAX_MESSAGE];
+    };
+    
+    static const size_t CAPACITY = 4096;
+    
+    static Level threshold;
+    static Slot* slots;
+    static size_t head;     // writer thread only
+    static size_t tail;     // claimed by producers with CAS
+    static size_t dropped;
+    static int running;
+    static pthread_t thread;
+    
+    static void* writerMain(void* arg);
+    static bool drain(std::string& out, std::string& err);
+    static void format(std::string& buffer, Level level, long seconds, long millis,
+                       const char* text, size_t length);
+    static void writeAll(int fd, const std::string& buffer);
+};
+
+// Builds one log line on the stack; the destructor hands it to the ring
+class LogLine {
+private:
+    Logger::Level level;
+    size_t length;
+    char buffer[Logger::MAX_MESSAGE];
+    
+    LogLine(const LogLine&);
+    LogLine& operator=(const LogLine&);
+    
+    void append(const char* text, size_t size);
+    void appendNumber(unsigned long value, bool negative);
+    
+public:
+    explicit LogLine(Logger::Level level);
+    ~LogLine();
+    
+    LogLine& operator<<(const char* text);
+    LogLine& operator<<(const std::string& text);
+    LogLine& operator<<(const StringRef& text);
+    LogLine& operator<<(char c);
+    LogLine& operator<<(int value);
+    LogLine& operator<<(unsigned int value);
+    LogLine& operator<<(long value);
+    LogLine& operator<<(unsigned long value);
+};
+
+// Lets LOG_AT be a single expression, so it is safe inside an unbraced if
+struct LogVoidify {
+    void operator&(const LogLine&) {}
+};
+
+// A disabled level costs one compare; its arguments are never evaluated
+#define LOG_AT(level) !Logger::isEnabled(level) ? (void)0 : LogVoidify() & LogLine(level)
+#define LOG_DEBUG LOG_AT(Logger::LEVEL_DEBUG)
+#define LOG_INFO LOG_AT(Logger::LEVEL_INFO)
+#define LOG_WARN LOG_AT(Logger::LEVEL_WARN)
+#define LOG_ERROR LOG_AT(Logger::LEVEL_ERROR)
+
+#endif
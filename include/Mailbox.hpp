@@ -0,0 +1,75 @@
+#ifndef MAILBOX_HPP
+#define MAILBOX_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <cstddef>
+
+class Client;
+class Payload;
+
+struct Message {
+    enum Type {
+        // Reactor -> command thread
+        CLIENT_CONNECTED,
+        CLIENT_LINE,
+        CLIENT_INPUT_TOO_LONG,
+        CLIENT_CLOSED,
+        // Command thread -> reactor
+        ATTACH,
+        DELIVER,
+        DISCONNECT,
+        RELEASE
+    };
+    
+    Type type;
+    Client* client;
+    Payload* payload;   // DELIVER; one reference travels with the message
+    std::string* text;  // line or close reason, freed by the consumer
+};
+
+// Single-producer/single-consumer lock-free ring with an eventfd doorbell.
+// Producers post during a loop iteration and call flush() once at the end,
+// so a burst costs one wakeup. When the ring is full, messages wait in a
+// producer-local backlog and the consumer wakes the producer after draining.
+// The backlog never drops messages; once it holds another ring's worth the
+// mailbox reports itself congested and the producer must stop adding to it.
+class Mailbox {
+private:
+    std::vector<Message> slots;
+    size_t mask;
+    size_t head;            // next slot to read, written by the consumer
+    char padding[64];       // keep producer and consumer indices on separate cache lines
+    size_t tail;            // next slot to write, written by the producer
+    int blocked;            // producer has a backlog waiting for room
+    std::deque<Message> backlog;
+    bool pending;
+    int eventFd;
+    
+    Mailbox(const Mailbox&);
+    Mailbox& operator=(const Mailbox&);
+    
+    bool push(const Message& message);
+    bool drainBacklog();
+    static void discard(const Message& message);
+    
+public:
+    explicit Mailbox(size_t capacity);
+    ~Mailbox();
+    
+    int getEventFd() const;
+    void notify();
+    
+    // Producer side
+    void post(const Message& message);
+    void flush();
+    bool isCongested() const;
+    
+    // Consumer side: acknowledge() before draining with receive()
+    void acknowledge();
+    bool receive(Message& message);
+    bool takeBlocked();
+};
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef MESSAGEVIEW_HPP
+#define MESSAGEVIEW_HPP
+
+#include <string>
+#include <cstddef>
+
+// Non-owning view into a character buffer
+struct StringRef {
+    const char* data;
+    size_t size;
+    
+    bool empty() const;
+    std::string str() const;
+    bool equalsIgnoreCase(const char* literal) const;  // `literal` in upper case
+};
+
+// One IRCv3 tag; `value` is still escaped as received
+struct MessageTag {
+    StringRef key;
+    StringRef value;
+};
+
+// Parsed IRC line as views into the caller's buffer. Valid only while that
+// buffer is: nothing is copied or allocated while parsing.
+struct MessageView {
+    static const size_t MAX_PARAMS = 15;
+    
+    StringRef tags;     // raw tag section, without the leading '@'
+    StringRef prefix;   // without the leading ':'
+    StringRef command;
+    StringRef params[MAX_PARAMS];
+    size_t paramCount;
+    
+    // Walks `tags` one entry at a time; start with cursor = tags
+    static bool nextTag(StringRef& cursor, MessageTag& tag);
+};
+
+// Finds only the command word, skipping tags and prefix, for callers that
+// do not need the parameters. Empty when the line has no command.
+StringRef peekCommand(const char* line, size_t length);
+
+// Tokenizes `line` (no CRLF) in a single pass. Past 14 middle parameters the
+// remainder becomes the 15th, as RFC 1459 requires. Returns false when no
+// command is present.
+bool parseMessage(const char* line, size_t length, MessageView& message);
+
+#endif
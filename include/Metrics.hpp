@@ -0,0 +1,63 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <cstddef>
+
+// Counters with a single writing thread. The owner updates them with plain
+// atomic stores (no locked instruction), any thread may read a recent value.
+inline void statAdd(size_t& counter, size_t amount) {
+    __atomic_store_n(&counter, counter + amount, __ATOMIC_RELAXED);
+}
+
+inline void statSub(size_t& counter, size_t amount) {
+    __atomic_store_n(&counter, counter - amount, __ATOMIC_RELAXED);
+}
+
+inline size_t statRead(const size_t& counter) {
+    return __atomic_load_n(&counter, __ATOMIC_RELAXED);
+}
+
+// Socket-side traffic of one reactor, written only by its thread
+struct ReactorStats {
+    size_t accepted;
+    size_t bytesIn;
+    size_t linesIn;
+    size_t bytesOut;
+    size_t messagesOut;
+    size_t sendqBytes;      // queued and not yet written, all clients
+    size_t sendqPeak;       // deepest single send queue seen
+    size_t throttled;       // times a client's input was held back by flood control
+    size_t congested;       // ... or because the command thread's mailbox was full
+    size_t tlsHandshakes;
+    size_t tlsResumed;      // handshakes that resumed an earlier session
+    size_t tlsKernelSend;   // connections whose records the kernel encrypts (kTLS)
+    
+    ReactorStats();
+};
+
+// Power-of-two buckets over nanoseconds: cheap to record, and percentiles
+// are reported as the upper bound of the bucket they fall in
+class LatencyHistogram {
+public:
+    static const size_t BUCKETS = 40;
+    
+private:
+    size_t counts[BUCKETS];
+    size_t samples;
+    unsigned long long total;
+    unsigned long long max;
+    
+public:
+    LatencyHistogram();
+    
+    void record(unsigned long long nanoseconds);
+    size_t getCount() const;
+    unsigned long long getMean() const;
+    unsigned long long getMax() const;
+    unsigned long long getPercentile(double percent) const;
+};
+
+// Monotonic clock for timing handlers
+unsigned long long monotonicNanos();
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef PAYLOAD_HPP
+#define PAYLOAD_HPP
+
+#include <string>
+#include <cstddef>
+
+// Immutable, reference-counted wire line. A fan-out serializes the message
+// once and every recipient's send queue holds a reference to the same bytes.
+class Payload {
+private:
+    int refs;
+    size_t length;
+    
+    Payload(size_t length);
+    ~Payload();
+    Payload(const Payload&);
+    Payload& operator=(const Payload&);
+    
+public:
+    // Single allocation holding header and bytes; CRLF appended if missing.
+    // The caller owns the initial reference.
+    static Payload* create(const std::string& message);
+    
+    void retain();
+    void release();
+    
+    const char* data() const;
+    size_t size() const;
+};
+
+#endif
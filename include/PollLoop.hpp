@@ -0,0 +1,27 @@
+#ifndef POLLLOOP_HPP
+#define POLLLOOP_HPP
+
+#include <vector>
+#include <poll.h>
+#include "EventLoop.hpp"
+
+class PollLoop : public EventLoop {
+private:
+    std::vector<pollfd> pollFds;
+    std::vector<int> indexByFd;     // position in pollFds, -1 when not registered
+    
+    int findIndex(int fd) const;
+    
+public:
+    PollLoop();
+    ~PollLoop();
+    
+    bool add(int fd, int events);
+    bool modify(int fd, int events);
+    void remove(int fd);
+    int wait(std::vector<IoEvent>& events, int timeoutMs);
+    bool isEdgeTriggered() const;
+    const char* getName() const;
+};
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef POOL_HPP
+#define POOL_HPP
+
+#include <cstddef>
+#include <new>
+
+// Carves fixed-size objects out of slabs so connection churn reuses the same
+// memory instead of fragmenting the heap. Free lists are per thread and a
+// slot goes onto the list of whichever thread frees it, which need not be
+// the one that allocated it: the command thread creates server-link clients,
+// remote users and clients restored by an upgrade, and reactor 0 frees the
+// link clients. Slabs are kept for the process lifetime, so a slot that
+// changes lists stays valid memory.
+void* allocateSlab(size_t bytes);
+
+template <typename T>
+class Pool {
+private:
+    union Slot {
+        Slot* next;
+        long double align;
+        char storage[sizeof(T)];
+    };
+    
+    static const size_t SLAB_OBJECTS = 64;
+    static __thread Slot* freeList;
+    
+    static void refill() {
+        Slot* slab = static_cast<Slot*>(allocateSlab(sizeof(Slot) * SLAB_OBJECTS));
+        for (size_t i = 0; i < SLAB_OBJECTS; ++i) {
+            slab[i].next = freeList;
+            freeList = &slab[i];
+        }
+    }
+    
+public:
+    static void* allocate(size_t size) {
+        // Derived classes are bigger than a slot; leave them to the heap
+        if (size != sizeof(T)) return ::operator new(size);
+        
+        if (!freeList) refill();
+        Slot* slot = freeList;
+        freeList = slot->next;
+        return slot;
+    }
+    
+    static void deallocate(void* p, size_t size) {
+        if (!p) return;
+        if (size != sizeof(T)) {
+            ::operator delete(p);
+            return;
+        }
+        
+        Slot* slot = static_cast<Slot*>(p);
+        slot->next = freeList;
+        freeList = slot;
+    }
+};
+
+template <typename T>
+__thread typename Pool<T>::Slot* Pool<T>::freeList = NULL;
+
+#endif
@@ -0,0 +1,128 @@
+#ifndef REACTOR_HPP
+#define REACTOR_HPP
+
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include "Client.hpp"
+#include "ClientTable.hpp"
+#include "Config.hpp"
+#include "EventLoop.hpp"
+#include "Mailbox.hpp"
+#include "Metrics.hpp"
+#include "TimerWheel.hpp"
+#include "Tls.hpp"
+#include "UringLoop.hpp"
+
+// Receives connection events on the command thread
+class ReactorHandler {
+public:
+    virtual ~ReactorHandler() {}
+    virtual void onClientConnected(Client* client) = 0;
+    virtual void onClientLine(Client* client, const StringRef& line) = 0;
+    virtual void onClientInputTooLong(Client* client) = 0;
+    virtual void onClientClosed(Client* client, const std::string& reason) = 0;
+    
+    // Flood control weight of a line. Runs on the socket thread, so it may
+    // only look at the line itself.
+    virtual unsigned getLineCost(const StringRef& line) const = 0;
+    
+    // A descriptor registered with Reactor::watch() is readable
+    virtual void onWatchedReadable(int fd) = 0;
+};
+
+// Owns a listening socket, an event loop and the sockets of the clients it
+// accepted. Single-threaded, it calls the handler inline. Threaded, it runs
+// on its own thread and exchanges Messages with the command thread through a
+// pair of mailboxes, so neither side ever takes a lock.
+class Reactor : public Transport, public TimerHandler {
+private:
+    const ServerConfig& config;
+    int listenFd;
+    int tlsListenFd;            // -1 without a TLS port
+    TlsContext* tlsContext;
+    ReactorHandler* handler;
+    EventLoop* loop;
+    UringLoop* uring;           // `loop` when it does the socket I/O itself, else NULL
+    std::vector<IoEvent> events;
+    ClientTable clients;
+    std::vector<int> pendingFlush;
+    std::vector<int> watched;
+    std::vector<int> throttled;     // clients with lines waiting on flood control or the outbox
+    TimerWheel timers;
+    unsigned long long now;         // monotonic ns, sampled once per loop iteration
+    Payload* pingPayload;
+    ReactorStats stats;
+    volatile int running;
+    
+    // Threaded mode only
+    Mailbox* inbox;   // command thread -> reactor
+    Mailbox* outbox;  // reactor -> command thread
+    pthread_t thread;
+    bool threadStarted;
+    
+    Reactor(const Reactor&);
+    Reactor& operator=(const Reactor&);
+    
+    // Socket thread
+    bool listenOn(int fd);
+    bool watchClient(int fd, bool tls);
+    void acceptClients(int fd, TlsContext* context);
+    void completeAccept(const IoEvent& event);
+    void addClient(int clientFd, const char* ip, TlsContext* context);
+    bool continueHandshake(Client* client);
+    void handleClientData(int clientFd);
+    void handleReceived(const IoEvent& event);
+    void commitInput(Client* client, size_t size);
+    bool processInput(Client* client);
+    void resumeThrottled();
+    int throttleTimeout() const;
+    int nextTimeout() const;
+    void armKeepalive(Client* client);
+    void onTimer(Timer* timer);
+    void flushPending();
+    bool flushClient(Client* client);
+    void startSend(Client* client);
+    void completeSend(const IoEvent& event);
+    void queueOutput(Client* client, Payload* payload);
+    void updateWriteInterest(Client* client);
+    void closeClient(Client* client);
+    void processInbox();
+    void notify(Message::Type type, Client* client, const StringRef& text);
+    static void* threadMain(void* arg);
+    
+public:
+    Reactor(const ServerConfig& config, int listenFd, ReactorHandler* handler, bool threaded);
+    ~Reactor();
+    
+    const char* getBackendName() const;
+    int getListenFd() const;
+    const ReactorStats& getStats() const;
+    
+    // Second listening socket whose clients speak TLS; the context is shared
+    void listenTls(int fd, TlsContext* context);
+    
+    // Extra descriptor served on this reactor's loop (single-threaded mode)
+    void watch(int fd);
+    
+    // Socket thread
+    void run();
+    void startThread();
+    void stop();
+    void resume();
+    void scheduleFlush(Client* client);
+    
+    // Takes over a connection handed on by the previous process, with the
+    // input it had not processed yet
+    void adopt(Client* client, const std::string& input);
+    
+    // Command thread; attach() hands over a socket it opened itself
+    void attach(Client* client);
+    void deliver(Client* client, Payload* payload);
+    void disconnect(Client* client, const std::string& reason);
+    int getEventFd() const;
+    void dispatchEvents();
+    void wake();
+};
+
+#endif
@@ -3,35 +3,172 @@
 
 #include <string>
 #include <map>
+#include <set>
 #include <vector>
-#include <poll.h>
+#include <tr1/unordered_map>
+#include <ctime>
 #include <netinet/in.h>
 #include "Client.hpp"
+#include "ClientTable.hpp"
 #include "Channel.hpp"
+#include "Config.hpp"
+#include "EventLoop.hpp"
+#include "Reactor.hpp"
+#include "Upgrade.hpp"
+#include "ChannelStore.hpp"
 
 class Command;
 
-class Server {
+class Server : public ReactorHandler {
 private:
     int port;
     std::string password;
-    int serverSocket;
-    std::vector<pollfd> pollFds;
-    std::map<int, Client*> clients;
+    ServerConfig config;
+    volatile int running;
+    std::vector<Reactor*> reactors;
+    int reactorsReady;          // set once `reactors` is built; signal handlers wait for it
+    EventLoop* commandLoop;
+    std::vector<IoEvent> events;
+    ClientTable clients;
     std::map<std::string, Channel*> channels;
+    ChannelStore store;         // saved topics, keys and modes; closed without --state-file
+    TlsContext* tlsContext;     // shared by every reactor's TLS socket; NULL without --tls-port
+    
+    // Case-folded nickname -> client, kept in sync on NICK and disconnect
+    std::tr1::unordered_map<std::string, Client*> nicknames;
+    
+    // Command-thread metrics; socket traffic is counted by each reactor
+    struct CommandStats {
+        size_t calls;
+        LatencyHistogram latency;
+        CommandStats() : calls(0) {}
+    };
+    std::vector<CommandStats> commandStats;    // by table index, unknown last
+    std::map<std::string, size_t> disconnects;
+    time_t startTime;
+    int statsFd;
+    
+    // Live upgrade, single reactor only
+    volatile int upgradeRequested;
+    bool handedOff;
+    
+    // Server links. Every server keeps the full user and channel state;
+    // remote users are Client objects whose route is the link toward them.
+    struct PeerLink {
+        std::string name;       // empty until the peer's SERVER line
+        std::string target;     // host:port for links we dialed
+        bool passOk;
+        PeerLink() : passOk(false) {}
+    };
+    std::string serverName;
+    std::map<Client*, PeerLink> links;
+    std::map<std::string, Client*> servers;    // every other server -> link toward it
+    std::set<Client*> linkCandidates;           // sent PASS with the link password
+    std::set<Client*> remoteUsers;
+    int linkTimerFd;
     
     // Socket and connection methods
-    void setupSocket();
-    void acceptClient();
-    void handleClientData(int clientFd);
-    void removeClient(int clientFd);
+    int createListener(int listenPort);
+    void runCommandLoop();
+    void detachClient(Client* client, const std::string& reason);
+    void disconnectClient(Client* client, const std::string& reason);
+    void broadcastToPeers(Client* client, const std::string& message, bool includeSelf);
+    
+    // Metrics
+    void openStatsSocket();
+    void serveStats();
+    void collectMetrics(std::vector<std::string>& lines) const;
+    void countDisconnect(const std::string& reason);
+    
+    // Live upgrade
+    bool handOver();
+    void serializeState(StateWriter& writer, std::vector<int>& fds);
+    void restoreState(int sock);
+    void noticeOpers(const std::string& text);
+    
+    // Server links (ServerLink.cpp)
+    void openLinkTimer();
+    void connectLinks();
+    void connectLink(const std::string& target);
+    void registerLink(Client* link, const std::string& name);
+    void sendBurst(Client* link);
+    void dropLink(Client* link, const std::string& reason);
+    void propagate(const std::string& line, Client* from);
+    void channelEvent(Channel* channel, const std::string& line, Client* from);
+    void forwardToChannel(Channel* channel, const std::string& line, Client* from);
+    void announceJoin(Channel* channel, Client* client, bool created);
+    std::string introduction(Client* client) const;
+    std::string channelSettings(Channel* channel) const;
+    void removeRemoteUser(Client* user, const std::string& reason);
+    void killUser(Client* user, const std::string& reason, Client* from);
+    
+    // Link verbs; `origin` is the user named by the prefix, NULL for servers
+    typedef void (Server::*LinkHandler)(Client* link, Client* origin, const Command& command,
+                                        const StringRef& line);
+    struct LinkEntry {
+        const char* name;
+        LinkHandler handler;
+        size_t minParams;
+        bool requiresUser;      // the prefix must be a user behind this link
+        bool requiresRegistration;
+    };
+    static const LinkEntry linkTable[];
+    void handleLinkLine(Client* link, const MessageView& message, const StringRef& line);
+    void linkPass(Client* link, Client* origin, const Command& command, const StringRef& line);
+    void linkServer(Client* link, Client* origin, const Command& command, const StringRef& line);
+    void linkSquit(Client* link, Client* origin, const Command& command, const StringRef& line);
+    void linkPing(Client* link, Client* origin, const Command& command, const StringRef& line);
+    void linkPong(Client* link, Client* origin, const Command& command, const StringRef& line);
+    void linkError(Client* link, Client* origin, const Command& command, const StringRef& line);
+    void linkNick(Client* link, Client* origin, const Command& command, const StringRef& line);
+    void linkQuit(Client* link, Client* origin, const Command& command, const StringRef& line);
+    void linkKill(Client* link, Client* origin, const Command& command, const StringRef& line);
+    void linkNjoin(Client* link, Client* origin, const Command& command, const StringRef& line);
+    void linkChanset(Client* link, Client* origin, const Command& command, const StringRef& line);
+    void linkPart(Client* link, Client* origin, const Command& command, const StringRef& line);
+    void linkKick(Client* link, Client* origin, const Command& command, const StringRef& line);
+    void linkMode(Client* link, Client* origin, const Command& command, const StringRef& line);
+    void linkTopic(Client* link, Client* origin, const Command& command, const StringRef& line);
+    void linkPrivmsg(Client* link, Client* origin, const Command& command, const StringRef& line);
+    void linkInvite(Client* link, Client* origin, const Command& command, const StringRef& line);
+    
+    // Command dispatch table; the parameter count is checked before the handler runs
+    typedef void (Server::*CommandHandler)(Client* client, const Command& command);
+    struct CommandEntry {
+        const char* name;
+        CommandHandler handler;
+        size_t minParams;
+        bool requiresRegistration;
+        unsigned cost;          // flood control weight
+    };
+    static const CommandEntry commandTable[];
+    static const CommandEntry* findCommand(const StringRef& name);
     
     // Command processing
-    void executeCommand(Client* client, const std::string& command);
+    void executeCommand(Client* client, const StringRef& line);
     void checkAuthentication(Client* client);
+    void setClientNickname(Client* client, const std::string& nickname);
     
     // Command handlers
+    void handlePass(Client* client, const Command& command);
+    void handleUser(Client* client, const Command& command);
+    void handlePing(Client* client, const Command& command);
+    void handleOper(Client* client, const Command& command);
+    void handleStats(Client* client, const Command& command);
+    void handleNames(Client* client, const Command& command);
+    void handlePong(Client* client, const Command& command);
+    void handleUpgrade(Client* client, const Command& command);
+    void handleServer(Client* client, const Command& command);
+    void sendNames(Client* client, Channel* channel);
+    void handleNick(Client* client, const Command& command);
     void handleJoin(Client* client, const Command& command);
+    void joinChannel(Client* client, const std::string& name, const std::string& key);
+    void saveChannelState(Channel* channel);
+    void partChannel(Client* client, const std::string& name, const std::string& reason);
+    void kickMember(Client* client, const std::string& channelName, const std::string& targetNick,
+                    const std::string& reason);
+    void sendPrivmsg(Client* client, const std::string& target, const std::string& text);
+    bool checkTargetCount(Client* client, const char* command, size_t count);
     void handlePrivmsg(Client* client, const Command& command);
     void handleKick(Client* client, const Command& command);
     void handlePart(Client* client, const Command& command);
@@ -41,14 +178,27 @@ private:
     void handleQuit(Client* client, const Command& command);
     
 public:
-    Server(int port, const std::string& password);
+    Server(int port, const std::string& password, const ServerConfig& config);
     ~Server();
     
     // Main server operations
     void start();
+    void stop();
+    
+    // Signal-safe; the upgrade starts once the current loop pass is done
+    void requestUpgrade();
+    bool hasHandedOff() const;
     void broadcast(const std::string& message, int excludeFd = -1);
     void sendToClient(int clientFd, const std::string& message);
     
+    // Reactor events
+    void onClientConnected(Client* client);
+    void onClientLine(Client* client, const StringRef& line);
+    void onClientInputTooLong(Client* client);
+    void onClientClosed(Client* client, const std::string& reason);
+    void onWatchedReadable(int fd);
+    unsigned getLineCost(const StringRef& line) const;
+    
     // Channel management
     Channel* getChannel(const std::string& name);
     Channel* createChannel(const std::string& name, Client* creator);
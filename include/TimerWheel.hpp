@@ -0,0 +1,78 @@
+#ifndef TIMERWHEEL_HPP
+#define TIMERWHEEL_HPP
+
+#include <cstddef>
+
+class Timer;
+
+class TimerHandler {
+public:
+    virtual ~TimerHandler() {}
+    virtual void onTimer(Timer* timer) = 0;
+};
+
+// Intrusive timer, embedded in the object it belongs to. It sits in at most
+// one wheel slot, so arming and cancelling only relink it. Cancel it before
+// the owner goes away.
+class Timer {
+private:
+    friend class TimerWheel;
+    
+    Timer* prev;
+    Timer* next;
+    unsigned long long expiry;      // in wheel ticks
+    
+    Timer(const Timer&);
+    Timer& operator=(const Timer&);
+    
+public:
+    TimerHandler* handler;
+    void* data;
+    
+    Timer();
+    
+    bool isArmed() const;
+};
+
+// Hierarchical timing wheel: LEVELS wheels of SLOTS slots, each level's slot
+// spanning a full turn of the level below. Timers go straight into the
+// slot of their expiry and are only moved down a level when the lower
+// wheel reaches them, so schedule and cancel are O(1) and advancing costs
+// one slot per tick plus the timers that actually fire or cascade.
+class TimerWheel {
+public:
+    static const size_t SLOT_BITS = 8;
+    static const size_t SLOTS = 1 << SLOT_BITS;
+    static const size_t LEVELS = 4;
+    
+private:
+    Timer slots[LEVELS][SLOTS];     // list heads
+    unsigned long long tickMs;
+    unsigned long long current;     // last tick processed
+    size_t count;
+    
+    TimerWheel(const TimerWheel&);
+    TimerWheel& operator=(const TimerWheel&);
+    
+    void link(Timer* timer);
+    static void unlink(Timer* timer);
+    void cascade(size_t level);
+    
+public:
+    TimerWheel(unsigned long long tickMs, unsigned long long nowMs);
+    
+    // Fires `timer` no sooner than `delayMs` after the last advance() and at
+    // most two ticks later; re-arms it when already pending
+    void schedule(Timer* timer, unsigned long long delayMs);
+    void cancel(Timer* timer);
+    
+    // Runs every timer due by `nowMs`. Handlers may schedule or cancel any
+    // timer, including the one that fired.
+    void advance(unsigned long long nowMs);
+    
+    // Milliseconds until the next timer may fire, -1 when none is armed
+    int nextTimeout(unsigned long long nowMs) const;
+    size_t size() const;
+};
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef TLS_HPP
+#define TLS_HPP
+
+#include <string>
+#include <cstddef>
+
+// OpenSSL's own struct tags, so this header does not pull in its headers
+struct ssl_st;
+struct ssl_ctx_st;
+
+// Server side of one TLS connection. Every call is non-blocking and maps
+// OpenSSL's state onto what the event loop has to wait for.
+class TlsSession {
+public:
+    enum Result { OK, WANT_READ, WANT_WRITE, CLOSED, FAILED };
+    
+private:
+    ssl_st* ssl;
+    bool established;
+    
+    explicit TlsSession(ssl_st* ssl);
+    TlsSession(const TlsSession&);
+    TlsSession& operator=(const TlsSession&);
+    
+    Result status(int ret);
+    
+    friend class TlsContext;
+    
+public:
+    ~TlsSession();
+    
+    // Drives the handshake; OK once it is complete
+    Result handshake();
+    bool isEstablished() const;
+    
+    // Like recv/send; `done` is set on OK
+    Result read(char* buffer, size_t size, size_t& done);
+    Result write(const char* data, size_t size, size_t& done);
+    
+    // Decrypted input OpenSSL holds that the socket will not signal again
+    bool hasPendingInput() const;
+    
+    // The kernel encrypts records for us (kTLS): plain sendmsg() works
+    bool isKernelSend() const;
+    bool isResumed() const;
+    std::string describe() const;
+    
+    // Best-effort close_notify
+    void shutdown();
+};
+
+// Certificate, key and session cache shared by every TLS connection.
+// Without USE_TLS the constructor throws.
+class TlsContext {
+private:
+    ssl_ctx_st* ctx;
+    
+    TlsContext(const TlsContext&);
+    TlsContext& operator=(const TlsContext&);
+    
+public:
+    // Throws std::runtime_error when the certificate or key cannot be used
+    TlsContext(const std::string& certFile, const std::string& keyFile);
+    ~TlsContext();
+    
+    // A session for an accepted socket, NULL when OpenSSL refuses one
+    TlsSession* accept(int fd);
+};
+
+#endif
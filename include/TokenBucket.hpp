@@ -0,0 +1,24 @@
+#ifndef TOKENBUCKET_HPP
+#define TOKENBUCKET_HPP
+
+// Input allowance of one client, in line-cost units. It refills at `rate`
+// per second up to `burst`. A line may take the balance below zero: it is
+// still handled, but no further line is until the bucket is positive again,
+// so an expensive command goes through and pays for it afterwards.
+class TokenBucket {
+private:
+    double tokens;
+    unsigned long long updated;     // monotonic ns of the last refill, 0 before first use
+    
+public:
+    TokenBucket();
+    
+    // Refills for the time elapsed since the last call; true when a line may run
+    bool ready(unsigned long long now, double burst, double rate);
+    void take(double cost);
+    
+    // Time until ready() turns true again, as of the last refill
+    unsigned long long nanosUntilReady(double rate) const;
+};
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef UPGRADE_HPP
+#define UPGRADE_HPP
+
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+// Flat encoding of the state handed to the next process. Both ends run on
+// the same machine, so integers go in host byte order.
+class StateWriter {
+private:
+    std::string buffer;
+    
+public:
+    void putInt(unsigned long long value);
+    void putString(const std::string& value);
+    const std::string& data() const;
+};
+
+class StateReader {
+private:
+    const std::string& buffer;
+    size_t pos;
+    bool failed;
+    
+public:
+    explicit StateReader(const std::string& buffer);
+    
+    // Past the end both return zero/empty and ok() turns false
+    unsigned long long getInt();
+    std::string getString();
+    bool ok() const;
+};
+
+// Descriptor number the successor finds the handoff socket on
+static const int UPGRADE_FD = 3;
+
+// Old process: fork()s and exec()s `arguments` (argv[0] first) with
+// --upgrade-fd, keeping only stdio and the handoff socket open in the
+// child. Returns our end of that socket, or -1.
+int spawnSuccessor(const std::vector<std::string>& arguments, pid_t& pid);
+
+// The state blob first, then the descriptors in SCM_RIGHTS batches
+bool sendState(int sock, const std::string& state, const std::vector<int>& fds);
+
+// True once the successor confirmed it took over
+bool waitForSuccessor(int sock, int timeoutMs);
+
+// New process
+bool receiveState(int sock, std::string& state, std::vector<int>& fds);
+void confirmHandoff(int sock);
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef URINGLOOP_HPP
+#define URINGLOOP_HPP
+
+#include <vector>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "EventLoop.hpp"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf;
+
+// io_uring backend. Readiness uses multishot poll, which reports wakeups
+// like edge-triggered epoll. The loop can also do the I/O itself: a
+// multishot accept per listening socket, a multishot recv per client that
+// takes buffers from a ring registered with the kernel, and sends queued
+// as requests. Everything queued during a loop iteration is submitted by
+// the same io_uring_enter() that waits for the next completions.
+class UringLoop : public EventLoop {
+public:
+    static const int MAX_SEND_IOV = 64;
+    
+private:
+    struct Send {
+        msghdr msg;
+        iovec iov[MAX_SEND_IOV];
+    };
+    
+    struct Slot {
+        unsigned generation;    // bumped by remove(); older completions are dropped
+        int events;             // poll interest, 0 when not polled
+        bool accepting;
+        bool receiving;
+        bool sending;
+        Send* send;             // kept for the fd's next send
+        Slot();
+    };
+    
+    // A multishot request that ended and is started again from wait()
+    struct Rearm {
+        int fd;
+        int op;
+        unsigned generation;
+        long long due;          // monotonic ms; 0 for the next wait()
+    };
+    
+    int ringFd;
+    void* ringMemory;
+    size_t ringSize;
+    io_uring_sqe* sqes;
+    size_t sqesSize;
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned sqMask;
+    unsigned sqEntries;
+    unsigned* sqArray;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned cqMask;
+    io_uring_cqe* cqes;
+    unsigned pending;           // queued and not yet submitted
+    
+    io_uring_buf* bufferRing;
+    char* buffers;
+    std::vector<unsigned short> used;   // handed out by wait(), back to the ring on the next
+    std::vector<Rearm> rearms;
+    
+    std::vector<Slot> slots;
+    
+    UringLoop(const UringLoop&);
+    UringLoop& operator=(const UringLoop&);
+    
+    Slot* find(int fd);
+    Slot& slot(int fd);
+    io_uring_sqe* nextSqe();
+    bool submit();
+    bool queuePoll(int fd);
+    bool queueAccept(int fd);
+    bool queueRecv(int fd);
+    bool queue(int fd, int op);
+    void rearm(int fd, int op, unsigned generation, int delayMs);
+    int startRearms(int timeoutMs);
+    void recycleBuffers();
+    void complete(const io_uring_cqe* cqe, std::vector<IoEvent>& events);
+    
+public:
+    // Throws std::runtime_error when the kernel lacks what this needs (6.0+)
+    UringLoop();
+    ~UringLoop();
+    
+    bool add(int fd, int events);
+    bool modify(int fd, int events);
+    void remove(int fd);
+    int wait(std::vector<IoEvent>& events, int timeoutMs);
+    bool isEdgeTriggered() const;
+    const char* getName() const;
+    
+    // Completion-based I/O; results come back from wait() as
+    // EVENT_ACCEPTED, EVENT_RECEIVED and EVENT_SENT
+    bool accept(int listenFd);
+    bool receive(int fd);
+    
+    // Room for the iovecs of the fd's next send, NULL while one is in
+    // flight; send() queues the first `count` of them, false when the
+    // kernel would not take the request
+    iovec* prepareSend(int fd);
+    bool send(int fd, int count);
+    bool isSending(int fd) const;
+};
+
+#endif
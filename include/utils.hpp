@@ -2,10 +2,20 @@
 #define UTILS_HPP
 
 #include <string>
+#include <vector>
 
 // String utilities
 std::string toUpper(const std::string& str);
 std::string toLower(const std::string& str);
 std::string trim(const std::string& str);
 
+// Splits a comma-separated target or key list. Empty items are kept so
+// keys stay paired with their channels by position
+void splitList(const std::string& list, std::vector<std::string>& items);
+
+// RFC1459 casemapping: a-z, {}| and ~ are the lowercase forms of A-Z,
+// []\ and ^. Lookups only need the equivalence, so each pair folds to one
+// fixed member: A-Z and []\ to lowercase, but ^ and ~ both to ^
+std::string ircCaseFold(const std::string& str);
+
 #endif
\ No newline at end of file
@@ -1,9 +1,6 @@
 #include "../include/Channel.hpp"
-#include <algorithm>
-#include <sys/socket.h>
-#include <cerrno>
 Channel::Channel(const std::string& name, Client* creator)
-    : name(name), inviteOnly(false), topicRestricted(true), userLimit(0) {
+    : name(name), inviteOnly(false), topicRestricted(true), userLimit(0), created(time(NULL)), namesWidth(0) {
     addClient(creator);
     addOperator(creator);
 }
@@ -11,6 +8,14 @@ Channel::Channel(const std::string& name, Client* creator)
 Channel::~Channel() {
 }
 
+void* Channel::operator new(size_t size) {
+    return Pool<Channel>::allocate(size);
+}
+
+void Channel::operator delete(void* p, size_t size) {
+    Pool<Channel>::deallocate(p, size);
+}
+
 const std::string& Channel::getName() const {
     return name;
 }
@@ -23,14 +28,22 @@ const std::string& Channel::getPassword() const {
     return password;
 }
 
-const std::vector<Client*>& Channel::getClients() const {
-    return clients;
+const std::vector<Member>& Channel::getMembers() const {
+    return members;
+}
+
+size_t Channel::getMemberCount() const {
+    return members.size();
 }
 
 int Channel::getUserLimit() const {
     return userLimit;
 }
 
+time_t Channel::getCreated() const {
+    return created;
+}
+
 void Channel::setTopic(const std::string& topic) {
     this->topic = topic;
 }
@@ -51,46 +64,106 @@ void Channel::setUserLimit(int limit) {
     this->userLimit = limit;
 }
 
+void Channel::setCreated(time_t created) {
+    this->created = created;
+}
+
 void Channel::addClient(Client* client) {
     if (!hasClient(client)) {
-        clients.push_back(client);
+        Member member = {client, 0};
+        memberIndex[client] = members.size();
+        members.push_back(member);
+        client->addChannel(this);
+        invalidateNames();
     }
 }
 
 void Channel::removeClient(Client* client) {
-    clients.erase(std::remove(clients.begin(), clients.end(), client), clients.end());
-    removeOperator(client);
+    std::tr1::unordered_map<Client*, size_t>::iterator it = memberIndex.find(client);
+    if (it != memberIndex.end()) {
+        // Swap-remove keeps the array dense; fix the moved member's slot
+        size_t slot = it->second;
+        memberIndex.erase(it);
+        if (slot != members.size() - 1) {
+            members[slot] = members.back();
+            memberIndex[members[slot].client] = slot;
+        }
+        members.pop_back();
+        invalidateNames();
+    }
+    client->removeChannel(this);
     removeInvited(client);
 }
 
 bool Channel::hasClient(Client* client) const {
-    return std::find(clients.begin(), clients.end(), client) != clients.end();
+    return memberIndex.find(client) != memberIndex.end();
+}
+
+const Member* Channel::findMember(Client* client) const {
+    std::tr1::unordered_map<Client*, size_t>::const_iterator it = memberIndex.find(client);
+    return (it != memberIndex.end()) ? &members[it->second] : NULL;
+}
+
+Member* Channel::lookupMember(Client* client) {
+    std::tr1::unordered_map<Client*, size_t>::iterator it = memberIndex.find(client);
+    return (it != memberIndex.end()) ? &members[it->second] : NULL;
 }
 
 void Channel::addOperator(Client* client) {
-    operators.insert(client);
+    Member* member = lookupMember(client);
+    if (member) {
+        member->flags |= MEMBER_OP;
+        invalidateNames();
+    }
 }
 
 void Channel::removeOperator(Client* client) {
-    operators.erase(client);
+    Member* member = lookupMember(client);
+    if (member) {
+        member->flags &= ~MEMBER_OP;
+        invalidateNames();
+    }
 }
 
 bool Channel::isOperator(Client* client) const {
-    return operators.find(client) != operators.end();
+    const Member* member = findMember(client);
+    return member && (member->flags & MEMBER_OP);
+}
+
+void Channel::setVoice(Client* client, bool voice) {
+    Member* member = lookupMember(client);
+    if (!member) return;
+    
+    if (voice)
+        member->flags |= MEMBER_VOICE;
+    else
+        member->flags &= ~MEMBER_VOICE;
+    invalidateNames();
+}
+
+bool Channel::isVoiced(Client* client) const {
+    const Member* member = findMember(client);
+    return member && (member->flags & MEMBER_VOICE);
 }
 
 void Channel::addInvited(Client* client) {
     invited.insert(client);
+    client->addInvite(this);
 }
 
 void Channel::removeInvited(Client* client) {
     invited.erase(client);
+    client->removeInvite(this);
 }
 
 bool Channel::isInvited(Client* client) const {
     return invited.find(client) != invited.end();
 }
 
+const std::set<Client*>& Channel::getInvited() const {
+    return invited;
+}
+
 bool Channel::isInviteOnly() const {
     return inviteOnly;
 }
@@ -107,16 +180,45 @@ bool Channel::hasUserLimit() const {
     return userLimit > 0;
 }
 
-void Channel::broadcast(const std::string& message, Client* exclude) {
-    for (size_t i = 0; i < clients.size(); ++i) {
-        if (clients[i] != exclude) {
-            send(clients[i]->getFd(), message.c_str(), message.size(), 0);
-            
-            // Add newline if not already present
-            if (message.find("\r\n") == std::string::npos) {
-                const char* newline = "\r\n";
-                send(clients[i]->getFd(), newline, 2, 0);
-            }
+const std::vector<std::string>& Channel::getNames(size_t width) {
+    if (namesWidth == width) return namesChunks;
+    
+    namesChunks.clear();
+    std::string chunk;
+    chunk.reserve(width);
+    for (size_t i = 0; i < members.size(); ++i) {
+        const std::string& nickname = members[i].client->getNickname();
+        size_t entry = nickname.size() + ((members[i].flags & (MEMBER_OP | MEMBER_VOICE)) ? 1 : 0);
+        
+        // A nickname longer than the width still gets a reply of its own
+        if (!chunk.empty() && chunk.size() + 1 + entry > width) {
+            namesChunks.push_back(chunk);
+            chunk.clear();
         }
+        if (!chunk.empty()) chunk += ' ';
+        if (members[i].flags & MEMBER_OP) chunk += '@';
+        else if (members[i].flags & MEMBER_VOICE) chunk += '+';
+        chunk += nickname;
+    }
+    if (!chunk.empty())
+        namesChunks.push_back(chunk);
+    
+    namesWidth = width;
+    return namesChunks;
+}
+
+void Channel::invalidateNames() {
+    namesWidth = 0;
+}
+
+void Channel::broadcast(const std::string& message, Client* exclude) {
+    // Serialize once; every member's queue shares the same buffer
+    Payload* payload = Payload::create(message);
+    
+    // Remote members are reached through their server link, once per link
+    for (size_t i = 0; i < members.size(); ++i) {
+        if (members[i].client != exclude && !members[i].client->isRemote())
+            members[i].client->queueMessage(payload);
     }
+    payload->release();
 }
\ No newline at end of file
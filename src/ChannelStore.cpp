@@ -0,0 +1,445 @@
+#include "../include/ChannelStore.hpp"
+#include "../include/Logger.hpp"
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <csignal>
+#include <stdexcept>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// "IRCCHANS" then a little-endian format version
+static const char MAGIC[8] = {'I', 'R', 'C', 'C', 'H', 'A', 'N', 'S'};
+static const unsigned FORMAT_VERSION = 1;
+static const size_t HEADER_SIZE = 12;
+
+// Per record: body length and checksum of the body
+static const size_t FRAME_SIZE = 8;
+
+enum {
+    RECORD_SET = 1,
+    RECORD_REMOVE = 2
+};
+
+// The file is rewritten once it holds twice the live records plus this many
+static const size_t COMPACT_SLACK = 10000;
+
+static void putU32(std::string& out, unsigned value) {
+    char bytes[4] = {
+        static_cast<char>(value), static_cast<char>(value >> 8),
+        static_cast<char>(value >> 16), static_cast<char>(value >> 24)
+    };
+    out.append(bytes, 4);
+}
+
+static unsigned getU32(const unsigned char* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<unsigned>(p[3]) << 24);
+}
+
+static void putString(std::string& out, const std::string& value) {
+    putU32(out, value.size());
+    out += value;
+}
+
+// FNV-1a over 32-bit little-endian words, a quarter of the multiplies of
+// the bytewise version on the load path
+static unsigned checksum(const unsigned char* data, size_t size) {
+    unsigned hash = 2166136261u;
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        hash ^= getU32(data + i);
+        hash *= 16777619u;
+    }
+    for (; i < size; ++i) {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static std::string header() {
+    std::string out(MAGIC, sizeof(MAGIC));
+    putU32(out, FORMAT_VERSION);
+    return out;
+}
+
+// Framed record for `name`; a removal when `state` is NULL
+static std::string encodeRecord(const std::string& name, const ChannelState* state) {
+    std::string body;
+    body += static_cast<char>(state ? RECORD_SET : RECORD_REMOVE);
+    putString(body, name);
+    if (state) {
+        putString(body, state->topic);
+        putString(body, state->key);
+        putU32(body, state->limit);
+        putU32(body, state->modes);
+    }
+    
+    std::string record;
+    record.reserve(FRAME_SIZE + body.size());
+    putU32(record, body.size());
+    putU32(record, checksum(reinterpret_cast<const unsigned char*>(body.data()), body.size()));
+    record += body;
+    return record;
+}
+
+// Size of the intact record at `offset`, or 0 where the journal ends
+static size_t frameAt(const unsigned char* data, size_t size, size_t offset) {
+    if (size - offset < FRAME_SIZE) return 0;
+    size_t length = getU32(data + offset);
+    if (size - offset - FRAME_SIZE < length) return 0;
+    if (checksum(data + offset + FRAME_SIZE, length) != getU32(data + offset + 4)) return 0;
+    return FRAME_SIZE + length;
+}
+
+// Bounds-checked reads over one record body
+class RecordReader {
+private:
+    const unsigned char* pos;
+    const unsigned char* end;
+    bool failed;
+    
+public:
+    RecordReader(const unsigned char* data, size_t size) : pos(data), end(data + size), failed(false) {}
+    
+    unsigned getU32() {
+        if (failed || end - pos < 4) {
+            failed = true;
+            return 0;
+        }
+        unsigned value = ::getU32(pos);
+        pos += 4;
+        return value;
+    }
+    
+    int getByte() {
+        if (failed || pos == end) {
+            failed = true;
+            return 0;
+        }
+        return *pos++;
+    }
+    
+    void getString(std::string& out) {
+        unsigned size = getU32();
+        if (failed || static_cast<size_t>(end - pos) < size) {
+            failed = true;
+            return;
+        }
+        out.assign(reinterpret_cast<const char*>(pos), size);
+        pos += size;
+    }
+    
+    bool done() const { return !failed && pos == end; }
+};
+
+static bool writeAll(int fd, const char* data, size_t size) {
+    while (size) {
+        ssize_t n = ::write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+ChannelState::ChannelState() : limit(0), modes(0) {
+}
+
+bool ChannelState::isEmpty() const {
+    return topic.empty() && key.empty() && limit == 0 && modes == 0;
+}
+
+ChannelStore::ChannelStore()
+    : writing(false), stopping(false), started(false), fd(-1), fileBytes(0), fileRecords(0), liveRecords(0),
+      broken(false) {
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&wake, NULL);
+    pthread_cond_init(&idle, NULL);
+}
+
+ChannelStore::~ChannelStore() {
+    if (started) {
+        // The writer drains what is queued before it exits
+        pthread_mutex_lock(&lock);
+        stopping = true;
+        pthread_cond_signal(&wake);
+        pthread_mutex_unlock(&lock);
+        pthread_join(thread, NULL);
+    }
+    if (fd != -1)
+        close(fd);
+    pthread_cond_destroy(&idle);
+    pthread_cond_destroy(&wake);
+    pthread_mutex_destroy(&lock);
+}
+
+void ChannelStore::open(const std::string& file) {
+    path = file;
+    load();
+    
+    // The writer must not take signals meant for the main thread
+    sigset_t all, previous;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &previous);
+    int result = pthread_create(&thread, NULL, writerMain, this);
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    if (result != 0)
+        throw std::runtime_error("Failed to start the channel store writer");
+    started = true;
+}
+
+void ChannelStore::load() {
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (fd == -1)
+        throw std::runtime_error("Cannot open channel state file " + path + ": " + strerror(errno));
+    
+    struct stat info;
+    if (fstat(fd, &info) == -1)
+        throw std::runtime_error("Cannot stat channel state file " + path);
+    size_t size = info.st_size;
+    
+    if (size == 0) {
+        std::string start = header();
+        if (!writeAll(fd, start.data(), start.size()) || fdatasync(fd) == -1)
+            throw std::runtime_error("Cannot write channel state file " + path);
+        fileBytes = start.size();
+        return;
+    }
+    
+    void* mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    if (mapped == MAP_FAILED)
+        throw std::runtime_error("Cannot map channel state file " + path);
+    const unsigned char* data = static_cast<const unsigned char*>(mapped);
+    
+    if (size < HEADER_SIZE || memcmp(data, MAGIC, sizeof(MAGIC)) != 0) {
+        munmap(mapped, size);
+        throw std::runtime_error(path + " is not a channel state file");
+    }
+    if (getU32(data + sizeof(MAGIC)) != FORMAT_VERSION) {
+        munmap(mapped, size);
+        throw std::runtime_error(path + " has an unsupported format version");
+    }
+    
+    // Size the table once from a quick walk over the record lengths
+    size_t count = 0;
+    for (size_t offset = HEADER_SIZE; size - offset >= FRAME_SIZE; ++count) {
+        size_t length = getU32(data + offset);
+        if (size - offset - FRAME_SIZE < length) break;
+        offset += FRAME_SIZE + length;
+    }
+    states.rehash(count);
+    
+    // Replay records in order; a torn or corrupt tail ends the journal
+    size_t offset = HEADER_SIZE;
+    size_t frame;
+    std::string name;
+    ChannelState state;
+    while ((frame = frameAt(data, size, offset)) != 0) {
+        RecordReader reader(data + offset + FRAME_SIZE, frame - FRAME_SIZE);
+        int type = reader.getByte();
+        reader.getString(name);
+        if (type == RECORD_SET) {
+            reader.getString(state.topic);
+            reader.getString(state.key);
+            state.limit = static_cast<int>(reader.getU32());
+            state.modes = static_cast<int>(reader.getU32());
+            if (!reader.done()) break;
+            
+            ChannelState& slot = states[name];
+            slot.topic.swap(state.topic);
+            slot.key.swap(state.key);
+            slot.limit = state.limit;
+            slot.modes = state.modes;
+        } else if (type == RECORD_REMOVE && reader.done()) {
+            states.erase(name);
+        } else {
+            break;
+        }
+        offset += frame;
+        ++fileRecords;
+    }
+    munmap(mapped, size);
+    
+    if (offset != size) {
+        LOG_WARN << "Channel state file " << path << ": dropping " << static_cast<unsigned long>(size - offset)
+                 << " unreadable bytes at offset " << static_cast<unsigned long>(offset);
+        if (ftruncate(fd, offset) == -1)
+            throw std::runtime_error("Cannot truncate channel state file " + path);
+    }
+    fileBytes = offset;
+    liveRecords = states.size();
+    LOG_INFO << "Loaded " << static_cast<unsigned long>(states.size()) << " saved channels from " << path;
+}
+
+bool ChannelStore::isOpen() const {
+    return started;
+}
+
+const ChannelState* ChannelStore::find(const std::string& name) const {
+    StateMap::const_iterator it = states.find(name);
+    return (it != states.end()) ? &it->second : NULL;
+}
+
+void ChannelStore::save(const std::string& name, const ChannelState& state) {
+    if (!started) return;
+    
+    Entry entry;
+    if (state.isEmpty()) {
+        // Nothing saved and nothing to save: no record needed
+        if (!states.erase(name)) return;
+        entry.record = encodeRecord(name, NULL);
+    } else {
+        states[name] = state;
+        entry.record = encodeRecord(name, &state);
+    }
+    entry.live = states.size();
+    
+    pthread_mutex_lock(&lock);
+    queue.push_back(entry);
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&lock);
+}
+
+size_t ChannelStore::size() const {
+    return states.size();
+}
+
+void ChannelStore::flush() {
+    if (!started) return;
+    
+    pthread_mutex_lock(&lock);
+    while (!queue.empty() || writing)
+        pthread_cond_wait(&idle, &lock);
+    pthread_mutex_unlock(&lock);
+}
+
+void* ChannelStore::writerMain(void* arg) {
+    ChannelStore* store = static_cast<ChannelStore*>(arg);
+    std::vector<Entry> batch;
+    
+    pthread_mutex_lock(&store->lock);
+    for (;;) {
+        while (store->queue.empty() && !store->stopping)
+            pthread_cond_wait(&store->wake, &store->lock);
+        if (store->queue.empty())
+            break;
+        
+        // Everything queued while the last batch was synced goes out in
+        // one write and one fdatasync
+        batch.swap(store->queue);
+        store->writing = true;
+        pthread_mutex_unlock(&store->lock);
+        
+        store->write(batch);
+        batch.clear();
+        
+        pthread_mutex_lock(&store->lock);
+        store->writing = false;
+        if (store->queue.empty())
+            pthread_cond_broadcast(&store->idle);
+    }
+    pthread_mutex_unlock(&store->lock);
+    return NULL;
+}
+
+void ChannelStore::write(std::vector<Entry>& batch) {
+    if (broken) return;
+    
+    std::string out;
+    for (size_t i = 0; i < batch.size(); ++i)
+        out += batch[i].record;
+    
+    if (!writeAll(fd, out.data(), out.size()) || fdatasync(fd) == -1) {
+        LOG_ERROR << "Channel state file " << path << ": write failed: " << strerror(errno);
+        // A torn record would end the replay on the next load and hide every
+        // record appended after it, so cut the file back to the last good one
+        if (ftruncate(fd, fileBytes) == -1) {
+            LOG_ERROR << "Channel state file " << path << ": cannot truncate, no longer saving: "
+                      << strerror(errno);
+            broken = true;
+        }
+        return;
+    }
+    fileBytes += out.size();
+    fileRecords += batch.size();
+    liveRecords = batch.back().live;
+    
+    if (fileRecords > 2 * liveRecords + COMPACT_SLACK)
+        compact();
+}
+
+void ChannelStore::compact() {
+    // Find the last record of every saved channel by replaying the journal,
+    // which only this thread appends to
+    void* mapped = mmap(NULL, fileBytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED) {
+        LOG_ERROR << "Channel state file " << path << ": cannot compact: " << strerror(errno);
+        return;
+    }
+    const unsigned char* data = static_cast<const unsigned char*>(mapped);
+    
+    typedef std::tr1::unordered_map<std::string, std::pair<size_t, size_t> > LatestMap;
+    LatestMap latest;
+    latest.rehash(liveRecords);
+    size_t frame;
+    std::string name;
+    for (size_t offset = HEADER_SIZE; (frame = frameAt(data, fileBytes, offset)) != 0; offset += frame) {
+        RecordReader reader(data + offset + FRAME_SIZE, frame - FRAME_SIZE);
+        int type = reader.getByte();
+        reader.getString(name);
+        if (type == RECORD_SET)
+            latest[name] = std::make_pair(offset, frame);
+        else
+            latest.erase(name);
+    }
+    
+    // Write them to a new file and rename it over the journal, so a crash
+    // at any point leaves one complete file behind
+    std::string temporary = path + ".tmp";
+    int out = ::open(temporary.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0600);
+    std::string buffer = header();
+    size_t written = 0;
+    bool ok = (out != -1);
+    for (LatestMap::const_iterator it = latest.begin(); ok && it != latest.end(); ++it) {
+        buffer.append(reinterpret_cast<const char*>(data + it->second.first), it->second.second);
+        if (buffer.size() >= 64 * 1024) {
+            ok = writeAll(out, buffer.data(), buffer.size());
+            written += buffer.size();
+            buffer.clear();
+        }
+    }
+    munmap(mapped, fileBytes);
+    ok = ok && writeAll(out, buffer.data(), buffer.size()) && fdatasync(out) == 0 &&
+         rename(temporary.c_str(), path.c_str()) == 0;
+    written += buffer.size();
+    if (!ok) {
+        LOG_ERROR << "Channel state file " << path << ": cannot compact: " << strerror(errno);
+        if (out != -1) {
+            close(out);
+            unlink(temporary.c_str());
+        }
+        return;
+    }
+    
+    // Make the rename itself durable
+    size_t slash = path.rfind('/');
+    std::string directory = (slash == std::string::npos) ? "." : path.substr(0, slash + 1);
+    int dir = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir != -1) {
+        fsync(dir);
+        close(dir);
+    }
+    
+    LOG_INFO << "Compacted channel state file " << path << " from " << static_cast<unsigned long>(fileBytes)
+             << " to " << static_cast<unsigned long>(written) << " bytes";
+    close(fd);
+    fd = out;
+    fileBytes = written;
+    fileRecords = latest.size();
+}
@@ -1,10 +1,38 @@
 #include "../include/Client.hpp"
+#include "../include/Tls.hpp"
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
 
-Client::Client(int fd, const std::string& ip)
-    : fd(fd), ip(ip), authenticated(false), passOk(false) {
+// Queued fragments gathered into a single sendmsg() call
+static const int MAX_FLUSH_IOV = 64;
+
+// Most plaintext a single TLS record carries
+static const size_t TLS_RECORD_SIZE = 16384;
+
+Client::Client(int fd, const std::string& ip, Transport* transport, size_t sendQueueLimit)
+    : fd(fd), ip(ip), authenticated(false), passOk(false), detached(false), oper(false),
+      serverLink(false), route(NULL), transport(transport), tls(NULL),
+      sendOffset(0), sendQueueBytes(0), sendQueueLimit(sendQueueLimit),
+      flushScheduled(false), waitingWritable(false), closing(false), closed(false), throttled(false),
+      lastInput(0), pingSent(0) {
+    rebuildPrefix();
 }
 
 Client::~Client() {
+    for (size_t i = 0; i < sendQueue.size(); ++i)
+        sendQueue[i]->release();
+    delete tls;
+}
+
+void* Client::operator new(size_t size) {
+    return Pool<Client>::allocate(size);
+}
+
+void Client::operator delete(void* p, size_t size) {
+    Pool<Client>::deallocate(p, size);
 }
 
 int Client::getFd() const {
@@ -27,20 +55,59 @@ const std::string& Client::getRealname() const {
     return realname;
 }
 
+const std::string& Client::getPrefix() const {
+    return prefix;
+}
+
 bool Client::isAuthenticated() const {
-    return authenticated;
+    // Also read by the socket thread when the registration deadline expires
+    return __atomic_load_n(&authenticated, __ATOMIC_ACQUIRE);
 }
 
 bool Client::isPassOk() const {
     return passOk;
 }
 
+bool Client::isDetached() const {
+    return detached;
+}
+
+bool Client::isOper() const {
+    return oper;
+}
+
+bool Client::isServerLink() const {
+    // Also read by the socket thread, which exempts links from flood control
+    return __atomic_load_n(&serverLink, __ATOMIC_ACQUIRE);
+}
+
+bool Client::isRemote() const {
+    return route != NULL;
+}
+
+Client* Client::getRoute() const {
+    return route;
+}
+
 void Client::setNickname(const std::string& nickname) {
     this->nickname = nickname;
+    rebuildPrefix();
 }
 
 void Client::setUsername(const std::string& username) {
     this->username = username;
+    rebuildPrefix();
+}
+
+void Client::rebuildPrefix() {
+    prefix.clear();
+    prefix.reserve(nickname.size() + username.size() + ip.size() + 3);
+    prefix += ':';
+    prefix += nickname;
+    prefix += '!';
+    prefix += username;
+    prefix += '@';
+    prefix += ip;
 }
 
 void Client::setRealname(const std::string& realname) {
@@ -48,42 +115,286 @@ void Client::setRealname(const std::string& realname) {
 }
 
 void Client::setAuthenticated(bool authenticated) {
-    this->authenticated = authenticated;
+    __atomic_store_n(&this->authenticated, authenticated, __ATOMIC_RELEASE);
 }
 
 void Client::setPassOk(bool passOk) {
     this->passOk = passOk;
 }
 
-void Client::appendBuffer(const std::string& data) {
-    buffer += data;
+void Client::setDetached(bool detached) {
+    this->detached = detached;
+}
+
+void Client::setOper(bool oper) {
+    this->oper = oper;
+}
+
+void Client::setServerLink(bool serverLink) {
+    __atomic_store_n(&this->serverLink, serverLink, __ATOMIC_RELEASE);
+}
+
+void Client::setRoute(Client* route) {
+    this->route = route;
+}
+
+void Client::addChannel(Channel* channel) {
+    channels.insert(channel);
+}
+
+void Client::removeChannel(Channel* channel) {
+    channels.erase(channel);
+}
+
+const std::set<Channel*>& Client::getChannels() const {
+    return channels;
+}
+
+void Client::addInvite(Channel* channel) {
+    invites.insert(channel);
+}
+
+void Client::removeInvite(Channel* channel) {
+    invites.erase(channel);
+}
+
+const std::set<Channel*>& Client::getInvites() const {
+    return invites;
+}
+
+LineBuffer& Client::getInput() {
+    return input;
+}
+
+TokenBucket& Client::getFloodBucket() {
+    return floodBucket;
+}
+
+bool Client::isThrottled() const {
+    return throttled;
+}
+
+void Client::setThrottled(bool throttled) {
+    this->throttled = throttled;
+}
+
+Timer& Client::getKeepalive() {
+    return keepalive;
+}
+
+unsigned long long Client::getLastInput() const {
+    return lastInput;
+}
+
+void Client::setLastInput(unsigned long long ms) {
+    lastInput = ms;
+}
+
+unsigned long long Client::getPingSent() const {
+    return pingSent;
+}
+
+void Client::setPingSent(unsigned long long ms) {
+    pingSent = ms;
+}
+
+void Client::queueMessage(Payload* payload) {
+    if (transport)
+        transport->deliver(this, payload);
+    else
+        appendOutput(payload);
+}
+
+void Client::queueMessage(const std::string& line) {
+    Payload* payload = Payload::create(line);
+    queueMessage(payload);
+    payload->release();
+}
+
+void Client::disconnect(const std::string& reason) {
+    if (transport)
+        transport->disconnect(this, reason);
+    else
+        markClosing(reason);
 }
 
-std::vector<std::string> Client::getCompletedCommands() {
-    std::vector<std::string> commands;
+void Client::appendOutput(Payload* payload) {
+    if (closing) return;
     
-    size_t pos = 0;
-    while ((pos = buffer.find("\r\n", pos)) != std::string::npos) {
-        std::string cmd = buffer.substr(0, pos);
-        commands.push_back(cmd);
-        buffer.erase(0, pos + 2);
-        pos = 0;
+    // A reader that cannot keep up is dropped rather than truncating its stream.
+    // Links carry whole bursts; a stalled one is caught by the ping timeout.
+    if (sendQueueLimit && sendQueueBytes + payload->size() > sendQueueLimit && !isServerLink()) {
+        markClosing("Max SendQ exceeded");
+        return;
     }
     
-    // Alternative for just \n (some clients may not send \r\n)
-    pos = 0;
-    while ((pos = buffer.find('\n', pos)) != std::string::npos) {
-        if (pos > 0 && buffer[pos - 1] == '\r') {
-            // Already handled above
-            pos++;
-            continue;
+    payload->retain();
+    sendQueue.push_back(payload);
+    sendQueueBytes += payload->size();
+    
+    if (!flushScheduled && transport) {
+        flushScheduled = true;
+        transport->scheduleFlush(this);
+    }
+}
+
+bool Client::flushSendQueue() {
+    // Without kTLS OpenSSL has to encrypt; with it the kernel does, and the
+    // queue goes out through sendmsg like plaintext
+    if (tls && !tls->isKernelSend())
+        return flushTls();
+    
+    while (!sendQueue.empty()) {
+        struct iovec iov[MAX_FLUSH_IOV];
+        int count = gatherOutput(iov, MAX_FLUSH_IOV);
+        
+        // sendmsg is writev with MSG_NOSIGNAL, so a reset peer cannot raise SIGPIPE
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+        
+        ssize_t sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+            markClosing("Write error");
+            return false;
+        }
+        consumeOutput(sent);
+    }
+    return true;
+}
+
+int Client::gatherOutput(struct iovec* iov, int max) const {
+    int count = 0;
+    for (size_t i = 0; i < sendQueue.size() && count < max; ++i, ++count) {
+        size_t skip = (i == 0) ? sendOffset : 0;
+        iov[count].iov_base = const_cast<char*>(sendQueue[i]->data()) + skip;
+        iov[count].iov_len = sendQueue[i]->size() - skip;
+    }
+    return count;
+}
+
+bool Client::flushTls() {
+    // Each SSL_write is a record, so small messages are packed into full
+    // ones. A write that has to wait is retried with the same leading bytes,
+    // which the queue still holds since nothing is released until written.
+    char record[TLS_RECORD_SIZE];
+    while (!sendQueue.empty()) {
+        size_t size = 0;
+        for (size_t i = 0; i < sendQueue.size() && size < sizeof(record); ++i) {
+            size_t skip = (i == 0) ? sendOffset : 0;
+            size_t length = std::min(sendQueue[i]->size() - skip, sizeof(record) - size);
+            memcpy(record + size, sendQueue[i]->data() + skip, length);
+            size += length;
         }
         
-        std::string cmd = buffer.substr(0, pos);
-        commands.push_back(cmd);
-        buffer.erase(0, pos + 1);
-        pos = 0;
+        size_t sent;
+        TlsSession::Result result = tls->write(record, size, sent);
+        if (result == TlsSession::WANT_WRITE || result == TlsSession::WANT_READ) return true;
+        if (result != TlsSession::OK) {
+            markClosing("Write error");
+            return false;
+        }
+        consumeOutput(sent);
+    }
+    return true;
+}
+
+void Client::consumeOutput(size_t sent) {
+    sendQueueBytes -= sent;
+    size_t remaining = sendOffset + sent;
+    while (!sendQueue.empty() && remaining >= sendQueue.front()->size()) {
+        remaining -= sendQueue.front()->size();
+        sendQueue.front()->release();
+        sendQueue.pop_front();
     }
+    sendOffset = remaining;
+}
+
+ssize_t Client::receive(char* buffer, size_t size) {
+    if (!tls) return recv(fd, buffer, size, 0);
     
-    return commands;
+    size_t done;
+    switch (tls->read(buffer, size, done)) {
+    case TlsSession::OK:
+        return done;
+    case TlsSession::WANT_READ:
+    case TlsSession::WANT_WRITE:
+        errno = EAGAIN;
+        return -1;
+    case TlsSession::CLOSED:
+        return 0;
+    default:
+        errno = EPROTO;
+        return -1;
+    }
+}
+
+TlsSession* Client::getTls() const {
+    return tls;
+}
+
+void Client::setTls(TlsSession* tls) {
+    this->tls = tls;
+}
+
+void Client::getPendingOutput(std::string& out) const {
+    out.reserve(sendQueueBytes);
+    for (size_t i = 0; i < sendQueue.size(); ++i) {
+        size_t skip = i ? 0 : sendOffset;
+        out.append(sendQueue[i]->data() + skip, sendQueue[i]->size() - skip);
+    }
+}
+
+bool Client::hasPendingOutput() const {
+    return !sendQueue.empty();
+}
+
+size_t Client::getSendQueueBytes() const {
+    return sendQueueBytes;
+}
+
+bool Client::isFlushScheduled() const {
+    return flushScheduled;
+}
+
+void Client::setFlushScheduled(bool scheduled) {
+    flushScheduled = scheduled;
+}
+
+bool Client::isWaitingWritable() const {
+    return waitingWritable;
+}
+
+void Client::setWaitingWritable(bool waiting) {
+    waitingWritable = waiting;
+}
+
+void Client::markClosing(const std::string& reason) {
+    if (closing) return;
+    
+    closing = true;
+    closeReason = reason;
+    if (!flushScheduled && transport) {
+        flushScheduled = true;
+        transport->scheduleFlush(this);
+    }
+}
+
+bool Client::isClosing() const {
+    return closing;
+}
+
+bool Client::isClosed() const {
+    return closed;
+}
+
+void Client::setClosed() {
+    closed = true;
+}
+
+const std::string& Client::getCloseReason() const {
+    return closeReason;
 }
\ No newline at end of file
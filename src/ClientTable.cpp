@@ -0,0 +1,26 @@
+#include "../include/ClientTable.hpp"
+
+ClientTable::ClientTable() : count(0) {
+}
+
+void ClientTable::insert(int fd, Client* client) {
+    if (static_cast<size_t>(fd) >= slots.size())
+        slots.resize(fd + 1, NULL);
+    if (!slots[fd]) ++count;
+    slots[fd] = client;
+}
+
+void ClientTable::erase(int fd) {
+    if (!find(fd)) return;
+    
+    slots[fd] = NULL;
+    --count;
+}
+
+size_t ClientTable::size() const {
+    return count;
+}
+
+int ClientTable::limit() const {
+    return static_cast<int>(slots.size());
+}
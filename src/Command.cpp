@@ -2,49 +2,18 @@
 #include "../include/utils.hpp"
 
 Command::Command(const std::string& raw) {
-    std::string commandStr = raw;
-    
-    // Check for prefix
-    if (!commandStr.empty() && commandStr[0] == ':') {
-        size_t spacePos = commandStr.find(' ');
-        if (spacePos != std::string::npos) {
-            prefix = commandStr.substr(1, spacePos - 1);
-            commandStr = commandStr.substr(spacePos + 1);
-        }
-    }
-    
-    // Extract command
-    size_t spacePos = commandStr.find(' ');
-    if (spacePos != std::string::npos) {
-        command = commandStr.substr(0, spacePos);
-        commandStr = commandStr.substr(spacePos + 1);
-    } else {
-        command = commandStr;
-        commandStr = "";
-    }
-    
-    // Extract parameters
-    while (!commandStr.empty()) {
-        if (commandStr[0] == ':') {
-            // Last parameter (all the rest of the string)
-            params.push_back(commandStr.substr(1));
-            break;
-        }
-        
-        spacePos = commandStr.find(' ');
-        if (spacePos != std::string::npos) {
-            std::string param = commandStr.substr(0, spacePos);
-            if (!param.empty()) {
-                params.push_back(param);
-            }
-            commandStr = commandStr.substr(spacePos + 1);
-        } else {
-            if (!commandStr.empty()) {
-                params.push_back(commandStr);
-            }
-            break;
-        }
-    }
+    MessageView message;
+    if (parseMessage(raw.data(), raw.size(), message))
+        *this = Command(message);
+}
+
+Command::Command(const MessageView& message)
+    : command(message.command.data, message.command.size),
+      prefix(message.prefix.data, message.prefix.size) {
+    // Each parameter is copied exactly once out of the receive buffer
+    params.reserve(message.paramCount);
+    for (size_t i = 0; i < message.paramCount; ++i)
+        params.push_back(message.params[i].str());
 }
 
 Command::~Command() {
@@ -60,4 +29,4 @@ const std::vector<std::string>& Command::getParams() const {
 
 const std::string& Command::getPrefix() const {
     return prefix;
-}
\ No newline at end of file
+}
@@ -0,0 +1,113 @@
+#include "../include/Config.hpp"
+#include <cstdlib>
+#include <arpa/inet.h>
+
+static bool parseSize(const std::string& value, size_t& out) {
+    if (value.empty() || value.find_first_not_of("0123456789") != std::string::npos)
+        return false;
+    out = static_cast<size_t>(std::strtoul(value.c_str(), NULL, 10));
+    return true;
+}
+
+// Upper bound for the reactor thread count
+static const int MAX_THREADS = 64;
+
+ServerConfig::ServerConfig() : backend("epoll"), sendQueueLimit(1048576), threads(1), logLevel(Logger::LEVEL_INFO),
+      maxTargets(20), floodBurst(20), floodRate(10),
+      pingInterval(120), pingTimeout(60), registrationTimeout(30),
+      tlsPort(0), upgradeFd(-1) {
+}
+
+bool ServerConfig::parseThreads(const std::string& value) {
+    size_t count;
+    if (!parseSize(value, count) || count < 1 || count > static_cast<size_t>(MAX_THREADS))
+        return false;
+    threads = static_cast<int>(count);
+    return true;
+}
+
+bool ServerConfig::parseOption(const std::string& arg) {
+    if (arg.compare(0, 2, "--") != 0) return false;
+    
+    size_t eq = arg.find('=');
+    if (eq == std::string::npos) return false;
+    
+    std::string name = arg.substr(2, eq - 2);
+    std::string value = arg.substr(eq + 1);
+    
+    if (name == "backend") {
+        if (value != "epoll" && value != "poll" && value != "uring") return false;
+        backend = value;
+        return true;
+    }
+    if (name == "sendq")
+        return parseSize(value, sendQueueLimit) && sendQueueLimit > 0;
+    if (name == "threads")
+        return parseThreads(value);
+    if (name == "log-level")
+        return Logger::parseLevel(value, logLevel);
+    if (name == "targmax")
+        return parseSize(value, maxTargets) && maxTargets > 0;
+    if (name == "flood-burst")
+        return parseSize(value, floodBurst) && floodBurst > 0;
+    if (name == "flood-rate")
+        return parseSize(value, floodRate);
+    if (name == "ping-interval")
+        return parseSize(value, pingInterval);
+    if (name == "ping-timeout")
+        return parseSize(value, pingTimeout) && pingTimeout > 0;
+    if (name == "registration-timeout")
+        return parseSize(value, registrationTimeout);
+    if (name == "upgrade-fd") {
+        size_t fd;
+        if (!parseSize(value, fd)) return false;
+        upgradeFd = static_cast<int>(fd);
+        return true;
+    }
+    if (name == "oper-password") {
+        operPassword = value;
+        return !value.empty();
+    }
+    if (name == "stats-socket") {
+        statsSocket = value;
+        return !value.empty();
+    }
+    if (name == "server-name") {
+        serverName = value;
+        return value.size() <= 63 && value.find('.') != std::string::npos &&
+               value.find_first_of(" :,!@*") == std::string::npos;
+    }
+    if (name == "link-password") {
+        linkPassword = value;
+        return !value.empty() && value.find(' ') == std::string::npos;
+    }
+    if (name == "connect") {
+        size_t colon = value.rfind(':');
+        if (colon == std::string::npos || colon == 0) return false;
+        size_t port;
+        if (!parseSize(value.substr(colon + 1), port) || port == 0 || port > 65535) return false;
+        struct in_addr addr;
+        if (inet_pton(AF_INET, value.substr(0, colon).c_str(), &addr) != 1) return false;
+        connectTo.push_back(value);
+        return true;
+    }
+    if (name == "tls-port") {
+        size_t tls;
+        if (!parseSize(value, tls) || tls == 0 || tls > 65535) return false;
+        tlsPort = static_cast<int>(tls);
+        return true;
+    }
+    if (name == "tls-cert") {
+        tlsCert = value;
+        return !value.empty();
+    }
+    if (name == "tls-key") {
+        tlsKey = value;
+        return !value.empty();
+    }
+    if (name == "state-file") {
+        stateFile = value;
+        return !value.empty();
+    }
+    return false;
+}
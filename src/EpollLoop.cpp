@@ -0,0 +1,69 @@
+#include "../include/EpollLoop.hpp"
+#include <unistd.h>
+#include <cerrno>
+#include <stdexcept>
+
+static uint32_t toEpollEvents(int events) {
+    uint32_t result = EPOLLET | EPOLLRDHUP;
+    if (events & EVENT_READ) result |= EPOLLIN;
+    if (events & EVENT_WRITE) result |= EPOLLOUT;
+    return result;
+}
+
+EpollLoop::EpollLoop() : epollFd(-1), readyEvents(64) {
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd == -1)
+        throw std::runtime_error("Failed to create epoll instance");
+}
+
+EpollLoop::~EpollLoop() {
+    if (epollFd != -1) close(epollFd);
+}
+
+bool EpollLoop::add(int fd, int events) {
+    epoll_event ev;
+    ev.events = toEpollEvents(events);
+    ev.data.fd = fd;
+    return epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+bool EpollLoop::modify(int fd, int events) {
+    epoll_event ev;
+    ev.events = toEpollEvents(events);
+    ev.data.fd = fd;
+    return epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &ev) == 0;
+}
+
+void EpollLoop::remove(int fd) {
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+int EpollLoop::wait(std::vector<IoEvent>& events, int timeoutMs) {
+    events.clear();
+    
+    int ready = epoll_wait(epollFd, &readyEvents[0], readyEvents.size(), timeoutMs);
+    if (ready == -1)
+        return errno == EINTR ? 0 : -1;
+    
+    for (int i = 0; i < ready; ++i) {
+        uint32_t revents = readyEvents[i].events;
+        IoEvent event = {readyEvents[i].data.fd, 0, 0, NULL};
+        if (revents & EPOLLIN) event.events |= EVENT_READ;
+        if (revents & EPOLLOUT) event.events |= EVENT_WRITE;
+        if (revents & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) event.events |= EVENT_ERROR;
+        events.push_back(event);
+    }
+    
+    // A full batch means more fds are probably waiting; grow for the next call
+    if (ready == static_cast<int>(readyEvents.size()))
+        readyEvents.resize(readyEvents.size() * 2);
+    return ready;
+}
+
+bool EpollLoop::isEdgeTriggered() const {
+    return true;
+}
+
+const char* EpollLoop::getName() const {
+    return "epoll";
+}
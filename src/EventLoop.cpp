@@ -0,0 +1,28 @@
+#include "../include/EventLoop.hpp"
+#include "../include/PollLoop.hpp"
+#include "../include/EpollLoop.hpp"
+#include "../include/UringLoop.hpp"
+#include "../include/Logger.hpp"
+#include <stdexcept>
+
+EventLoop::~EventLoop() {
+}
+
+EventLoop* EventLoop::create(const std::string& backend) {
+    if (backend == "poll")
+        return new PollLoop();
+    if (backend == "uring") {
+        try {
+            return new UringLoop();
+        } catch (const std::exception& e) {
+            LOG_WARN << e.what() << ", falling back to epoll";
+        }
+    }
+    
+    try {
+        return new EpollLoop();
+    } catch (const std::exception& e) {
+        LOG_WARN << e.what() << ", falling back to poll";
+        return new PollLoop();
+    }
+}
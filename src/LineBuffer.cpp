@@ -0,0 +1,89 @@
+#include "../include/LineBuffer.hpp"
+#include <cstring>
+
+LineBuffer::LineBuffer() : data(NULL), start(0), end(0), scan(0), discarding(false) {
+}
+
+LineBuffer::~LineBuffer() {
+    delete[] data;
+}
+
+char* LineBuffer::prepareWrite(size_t& room) {
+    if (!data)
+        data = new char[CAPACITY];
+    
+    // A partial line is at most MAX_TAGGED_LINE bytes, so moving it to the
+    // front is cheap and always leaves room for another read
+    if (start == end) {
+        start = end = scan = 0;
+    } else if (CAPACITY - end < MAX_LINE && start > 0) {
+        memmove(data, data + start, end - start);
+        end -= start;
+        scan -= start;
+        start = 0;
+    }
+    
+    room = CAPACITY - end;
+    return data + end;
+}
+
+void LineBuffer::commit(size_t count) {
+    end += count;
+}
+
+LineBuffer::Status LineBuffer::nextLine(StringRef& line) {
+    while (start < end) {
+        const char* newline = static_cast<const char*>(memchr(data + scan, '\n', end - scan));
+        size_t limit = (data[start] == '@') ? MAX_TAGGED_LINE : MAX_LINE;
+        
+        if (!newline) {
+            scan = end;
+            if (discarding || end - start > limit) {
+                // Overlong line without an end yet: drop what we have and
+                // keep dropping until its newline shows up
+                bool reported = discarding;
+                discarding = true;
+                start = scan = end;
+                if (!reported)
+                    return LINE_TOO_LONG;
+            }
+            return NO_LINE;
+        }
+        
+        size_t lineEnd = newline - data;
+        size_t lineStart = start;
+        start = scan = lineEnd + 1;
+        
+        if (discarding) {
+            discarding = false;
+            continue;
+        }
+        if (lineEnd + 1 - lineStart > limit)
+            return LINE_TOO_LONG;
+        
+        // Accept both CRLF and bare LF
+        if (lineEnd > lineStart && data[lineEnd - 1] == '\r')
+            --lineEnd;
+        line.data = data + lineStart;
+        line.size = lineEnd - lineStart;
+        return LINE;
+    }
+    return NO_LINE;
+}
+
+void LineBuffer::release() {
+    if (start != end) return;
+    
+    delete[] data;
+    data = NULL;
+    start = end = scan = 0;
+}
+
+StringRef LineBuffer::buffered() const {
+    StringRef pending = {data ? data + start : NULL, end - start};
+    return pending;
+}
+
+size_t LineBuffer::size() const {
+    return end - start;
+}
@@ -0,0 +1,252 @@
+#include "../include/Logger.hpp"
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <csignal>
+#include <unistd.h>
+#include <sys/time.h>
+
+Logger::Level Logger::threshold = Logger::LEVEL_INFO;
+Logger::Slot* Logger::slots = NULL;
+size_t Logger::head = 0;
+size_t Logger::tail = 0;
+size_t Logger::dropped = 0;
+int Logger::running = 0;
+pthread_t Logger::thread;
+
+static const char* LEVEL_NAMES[] = {"DEBUG", "INFO ", "WARN ", "ERROR"};
+
+// Idle writer sleeps this long between polls of the ring
+static const long WRITER_IDLE_NS = 10 * 1000 * 1000;
+
+void Logger::start(Level level) {
+    threshold = level;
+    if (slots) return;
+    
+    slots = new Slot[CAPACITY];
+    for (size_t i = 0; i < CAPACITY; ++i)
+        slots[i].sequence = i;
+    head = tail = 0;
+    
+    // The writer must not take signals meant for the main thread
+    sigset_t all, previous;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &previous);
+    __atomic_store_n(&running, 1, __ATOMIC_RELEASE);
+    if (pthread_create(&thread, NULL, writerMain, NULL) != 0) {
+        running = 0;
+        delete[] slots;
+        slots = NULL;
+    }
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+}
+
+void Logger::shutdown() {
+    if (!slots) return;
+    
+    __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+    pthread_join(thread, NULL);
+    delete[] slots;
+    slots = NULL;
+}
+
+bool Logger::parseLevel(const std::string& name, Level& level) {
+    if (name == "debug") level = LEVEL_DEBUG;
+    else if (name == "info") level = LEVEL_INFO;
+    else if (name == "warn") level = LEVEL_WARN;
+    else if (name == "error") level = LEVEL_ERROR;
+    else return false;
+    return true;
+}
+
+void Logger::commit(Level level, const char* text, size_t length) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    
+    if (!__atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+        std::string line;
+        format(line, level, now.tv_sec, now.tv_usec / 1000, text, length);
+        writeAll(level >= LEVEL_WARN ? STDERR_FILENO : STDOUT_FILENO, line);
+        return;
+    }
+    
+    // Bounded multi-producer queue: a slot is free for position `pos` when
+    // its sequence equals pos, and readable when it equals pos + 1
+    size_t pos = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+    Slot* slot;
+    for (;;) {
+        slot = &slots[pos & (CAPACITY - 1)];
+        size_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        long diff = static_cast<long>(sequence) - static_cast<long>(pos);
+        
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&tail, &pos, pos + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (diff < 0) {
+            __atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+            return;
+        } else {
+            pos = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+        }
+    }
+    
+    slot->level = level;
+    slot->seconds = now.tv_sec;
+    slot->millis = now.tv_usec / 1000;
+    slot->length = length;
+    memcpy(slot->text, text, length);
+    __atomic_store_n(&slot->sequence, pos + 1, __ATOMIC_RELEASE);
+}
+
+void* Logger::writerMain(void*) {
+    std::string out;
+    std::string err;
+    
+    for (;;) {
+        bool stopping = !__atomic_load_n(&running, __ATOMIC_ACQUIRE);
+        bool any = drain(out, err);
+        
+        size_t lost = __atomic_exchange_n(&dropped, 0, __ATOMIC_RELAXED);
+        if (lost) {
+            LogLine note(LEVEL_WARN);
+            note << static_cast<unsigned long>(lost) << " log lines dropped";
+        }
+        
+        if (!out.empty()) writeAll(STDOUT_FILENO, out);
+        if (!err.empty()) writeAll(STDERR_FILENO, err);
+        out.clear();
+        err.clear();
+        
+        if (stopping) {
+            // Catch lines committed while the last batch was written
+            if (drain(out, err)) {
+                writeAll(STDOUT_FILENO, out);
+                writeAll(STDERR_FILENO, err);
+            }
+            break;
+        }
+        if (!any) {
+            struct timespec idle = {0, WRITER_IDLE_NS};
+            nanosleep(&idle, NULL);
+        }
+    }
+    return NULL;
+}
+
+bool Logger::drain(std::string& out, std::string& err) {
+    bool any = false;
+    for (;;) {
+        Slot* slot = &slots[head & (CAPACITY - 1)];
+        if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != head + 1)
+            break;
+        
+        format(slot->level >= LEVEL_WARN ? err : out, slot->level,
+               slot->seconds, slot->millis, slot->text, slot->length);
+        __atomic_store_n(&slot->sequence, head + CAPACITY, __ATOMIC_RELEASE);
+        ++head;
+        any = true;
+    }
+    return any;
+}
+
+void Logger::format(std::string& buffer, Level level, long seconds, long millis,
+                    const char* text, size_t length) {
+    time_t when = seconds;
+    struct tm local;
+    localtime_r(&when, &local);
+    
+    char stamp[32];
+    size_t size = strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &local);
+    stamp[size++] = '.';
+    stamp[size++] = static_cast<char>('0' + millis / 100);
+    stamp[size++] = static_cast<char>('0' + millis / 10 % 10);
+    stamp[size++] = static_cast<char>('0' + millis % 10);
+    
+    buffer.append(stamp, size);
+    buffer += ' ';
+    buffer.append(LEVEL_NAMES[level]);
+    buffer += ' ';
+    buffer.append(text, length);
+    buffer += '\n';
+}
+
+void Logger::writeAll(int fd, const std::string& buffer) {
+    size_t written = 0;
+    while (written < buffer.size()) {
+        ssize_t n = write(fd, buffer.data() + written, buffer.size() - written);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        written += n;
+    }
+}
+
+LogLine::LogLine(Logger::Level level) : level(level), length(0) {
+}
+
+LogLine::~LogLine() {
+    Logger::commit(level, buffer, length);
+}
+
+void LogLine::append(const char* text, size_t size) {
+    // Overlong lines are truncated to the slot size
+    if (size > Logger::MAX_MESSAGE - length)
+        size = Logger::MAX_MESSAGE - length;
+    memcpy(buffer + length, text, size);
+    length += size;
+}
+
+void LogLine::appendNumber(unsigned long value, bool negative) {
+    char digits[24];
+    size_t pos = sizeof(digits);
+    do {
+        digits[--pos] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value);
+    if (negative)
+        digits[--pos] = '-';
+    append(digits + pos, sizeof(digits) - pos);
+}
+
+LogLine& LogLine::operator<<(const char* text) {
+    append(text, strlen(text));
+    return *this;
+}
+
+LogLine& LogLine::operator<<(const std::string& text) {
+    append(text.data(), text.size());
+    return *this;
+}
+
+LogLine& LogLine::operator<<(const StringRef& text) {
+    append(text.data, text.size);
+    return *this;
+}
+
+LogLine& LogLine::operator<<(char c) {
+    append(&c, 1);
+    return *this;
+}
+
+LogLine& LogLine::operator<<(int value) {
+    return *this << static_cast<long>(value);
+}
+
+LogLine& LogLine::operator<<(unsigned int value) {
+    return *this << static_cast<unsigned long>(value);
+}
+
+LogLine& LogLine::operator<<(long value) {
+    if (value < 0)
+        appendNumber(0UL - static_cast<unsigned long>(value), true);
+    else
+        appendNumber(static_cast<unsigned long>(value), false);
+    return *this;
+}
+
+LogLine& LogLine::operator<<(unsigned long value) {
+    appendNumber(value, false);
+    return *this;
+}
@@ -0,0 +1,112 @@
+#include "../include/Mailbox.hpp"
+#include "../include/Payload.hpp"
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdexcept>
+
+Mailbox::Mailbox(size_t capacity)
+    : head(0), tail(0), blocked(0), pending(false), eventFd(-1) {
+    size_t size = 1;
+    while (size < capacity) size <<= 1;
+    slots.resize(size);
+    mask = size - 1;
+    
+    eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (eventFd == -1)
+        throw std::runtime_error("Failed to create mailbox eventfd");
+}
+
+Mailbox::~Mailbox() {
+    // Messages nobody received still own their text and payload reference
+    for (size_t h = head; h != tail; ++h)
+        discard(slots[h & mask]);
+    for (size_t i = 0; i < backlog.size(); ++i)
+        discard(backlog[i]);
+    if (eventFd != -1) close(eventFd);
+}
+
+void Mailbox::discard(const Message& message) {
+    delete message.text;
+    if (message.payload)
+        message.payload->release();
+}
+
+int Mailbox::getEventFd() const {
+    return eventFd;
+}
+
+void Mailbox::notify() {
+    uint64_t one = 1;
+    ssize_t ignored = write(eventFd, &one, sizeof(one));
+    (void)ignored;
+}
+
+bool Mailbox::push(const Message& message) {
+    size_t t = tail;
+    if (t - __atomic_load_n(&head, __ATOMIC_ACQUIRE) == slots.size())
+        return false;
+    
+    slots[t & mask] = message;
+    __atomic_store_n(&tail, t + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+void Mailbox::post(const Message& message) {
+    // Keep ordering: once something is backlogged, everything after it is too
+    if (!backlog.empty() || !push(message))
+        backlog.push_back(message);
+    else
+        pending = true;
+}
+
+bool Mailbox::drainBacklog() {
+    bool moved = false;
+    while (!backlog.empty() && push(backlog.front())) {
+        backlog.pop_front();
+        moved = true;
+    }
+    return moved;
+}
+
+void Mailbox::flush() {
+    if (drainBacklog())
+        pending = true;
+    
+    if (!backlog.empty()) {
+        // Ask the consumer to wake us once it has drained, then retry in case
+        // it already did so before seeing the flag
+        __atomic_store_n(&blocked, 1, __ATOMIC_SEQ_CST);
+        if (drainBacklog())
+            pending = true;
+    }
+    
+    if (pending) {
+        pending = false;
+        notify();
+    }
+}
+
+bool Mailbox::isCongested() const {
+    return backlog.size() >= slots.size();
+}
+
+void Mailbox::acknowledge() {
+    uint64_t count;
+    ssize_t ignored = read(eventFd, &count, sizeof(count));
+    (void)ignored;
+}
+
+bool Mailbox::receive(Message& message) {
+    size_t h = head;
+    if (h == __atomic_load_n(&tail, __ATOMIC_ACQUIRE))
+        return false;
+    
+    message = slots[h & mask];
+    __atomic_store_n(&head, h + 1, __ATOMIC_SEQ_CST);
+    return true;
+}
+
+bool Mailbox::takeBlocked() {
+    return __atomic_exchange_n(&blocked, 0, __ATOMIC_SEQ_CST) != 0;
+}
@@ -0,0 +1,108 @@
+#include "../include/MessageView.hpp"
+#include <cstring>
+#include <cctype>
+
+bool StringRef::empty() const {
+    return size == 0;
+}
+
+std::string StringRef::str() const {
+    return std::string(data, size);
+}
+
+bool StringRef::equalsIgnoreCase(const char* literal) const {
+    for (size_t i = 0; i < size; ++i) {
+        if (!literal[i] || std::toupper(static_cast<unsigned char>(data[i])) != literal[i])
+            return false;
+    }
+    return literal[size] == '\0';
+}
+
+static StringRef makeRef(const char* data, size_t size) {
+    StringRef ref = {data, size};
+    return ref;
+}
+
+// Returns the end of the token starting at `pos`
+static const char* tokenEnd(const char* pos, const char* end) {
+    const char* space = static_cast<const char*>(memchr(pos, ' ', end - pos));
+    return space ? space : end;
+}
+
+static const char* skipSpaces(const char* pos, const char* end) {
+    while (pos < end && *pos == ' ')
+        ++pos;
+    return pos;
+}
+
+StringRef peekCommand(const char* line, size_t length) {
+    const char* pos = line;
+    const char* end = line + length;
+    
+    if (pos < end && *pos == '@')
+        pos = skipSpaces(tokenEnd(pos, end), end);
+    if (pos < end && *pos == ':')
+        pos = tokenEnd(pos, end);
+    pos = skipSpaces(pos, end);
+    return makeRef(pos, tokenEnd(pos, end) - pos);
+}
+
+bool parseMessage(const char* line, size_t length, MessageView& message) {
+    const char* pos = line;
+    const char* end = line + length;
+    
+    message.tags = makeRef(NULL, 0);
+    message.prefix = makeRef(NULL, 0);
+    message.command = makeRef(NULL, 0);
+    message.paramCount = 0;
+    
+    if (pos < end && *pos == '@') {
+        const char* stop = tokenEnd(pos, end);
+        message.tags = makeRef(pos + 1, stop - pos - 1);
+        pos = skipSpaces(stop, end);
+    }
+    
+    if (pos < end && *pos == ':') {
+        const char* stop = tokenEnd(pos, end);
+        message.prefix = makeRef(pos + 1, stop - pos - 1);
+        pos = skipSpaces(stop, end);
+    } else {
+        pos = skipSpaces(pos, end);
+    }
+    
+    const char* stop = tokenEnd(pos, end);
+    message.command = makeRef(pos, stop - pos);
+    if (message.command.empty())
+        return false;
+    pos = skipSpaces(stop, end);
+    
+    while (pos < end) {
+        // Trailing parameter, or the 15th which swallows the rest of the line
+        if (*pos == ':' || message.paramCount == MessageView::MAX_PARAMS - 1) {
+            if (*pos == ':') ++pos;
+            message.params[message.paramCount++] = makeRef(pos, end - pos);
+            break;
+        }
+        
+        stop = tokenEnd(pos, end);
+        message.params[message.paramCount++] = makeRef(pos, stop - pos);
+        pos = skipSpaces(stop, end);
+    }
+    return true;
+}
+
+bool MessageView::nextTag(StringRef& cursor, MessageTag& tag) {
+    if (cursor.empty())
+        return false;
+    
+    const char* end = cursor.data + cursor.size;
+    const char* semi = static_cast<const char*>(memchr(cursor.data, ';', cursor.size));
+    const char* stop = semi ? semi : end;
+    const char* eq = static_cast<const char*>(memchr(cursor.data, '=', stop - cursor.data));
+    
+    tag.key = makeRef(cursor.data, (eq ? eq : stop) - cursor.data);
+    tag.value = eq ? makeRef(eq + 1, stop - eq - 1) : makeRef(stop, 0);
+    
+    cursor = semi ? makeRef(semi + 1, end - semi - 1) : makeRef(end, 0);
+    return true;
+}
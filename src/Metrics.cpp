@@ -0,0 +1,58 @@
+#include "../include/Metrics.hpp"
+#include <cstring>
+#include <ctime>
+
+ReactorStats::ReactorStats()
+    : accepted(0), bytesIn(0), linesIn(0), bytesOut(0), messagesOut(0),
+      sendqBytes(0), sendqPeak(0), throttled(0), congested(0), tlsHandshakes(0), tlsResumed(0), tlsKernelSend(0) {
+}
+
+LatencyHistogram::LatencyHistogram() : samples(0), total(0), max(0) {
+    memset(counts, 0, sizeof(counts));
+}
+
+void LatencyHistogram::record(unsigned long long nanoseconds) {
+    // Bucket i holds values in [2^i, 2^(i+1))
+    size_t bucket = nanoseconds ? 63 - __builtin_clzll(nanoseconds) : 0;
+    if (bucket >= BUCKETS) bucket = BUCKETS - 1;
+    
+    ++counts[bucket];
+    ++samples;
+    total += nanoseconds;
+    if (nanoseconds > max) max = nanoseconds;
+}
+
+size_t LatencyHistogram::getCount() const {
+    return samples;
+}
+
+unsigned long long LatencyHistogram::getMean() const {
+    return samples ? total / samples : 0;
+}
+
+unsigned long long LatencyHistogram::getMax() const {
+    return max;
+}
+
+unsigned long long LatencyHistogram::getPercentile(double percent) const {
+    if (!samples) return 0;
+    
+    size_t rank = static_cast<size_t>(samples * percent / 100);
+    if (rank >= samples) rank = samples - 1;
+    
+    size_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; ++i) {
+        seen += counts[i];
+        if (seen > rank) {
+            unsigned long long bound = 2ULL << i;
+            return bound < max ? bound : max;
+        }
+    }
+    return max;
+}
+
+unsigned long long monotonicNanos() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<unsigned long long>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
@@ -0,0 +1,44 @@
+#include "../include/Payload.hpp"
+#include <cstring>
+#include <new>
+
+Payload::Payload(size_t length) : refs(1), length(length) {
+}
+
+Payload::~Payload() {
+}
+
+Payload* Payload::create(const std::string& message) {
+    size_t size = message.size();
+    bool needsCrlf = size < 2 || message.compare(size - 2, 2, "\r\n") != 0;
+    if (needsCrlf) size += 2;
+    
+    void* memory = ::operator new(sizeof(Payload) + size);
+    Payload* payload = new (memory) Payload(size);
+    
+    char* bytes = reinterpret_cast<char*>(payload + 1);
+    memcpy(bytes, message.data(), message.size());
+    if (needsCrlf)
+        memcpy(bytes + message.size(), "\r\n", 2);
+    return payload;
+}
+
+// Atomic because reactor threads drop their references concurrently
+void Payload::retain() {
+    __sync_add_and_fetch(&refs, 1);
+}
+
+void Payload::release() {
+    if (__sync_sub_and_fetch(&refs, 1) == 0) {
+        this->~Payload();
+        ::operator delete(this);
+    }
+}
+
+const char* Payload::data() const {
+    return reinterpret_cast<const char*>(this + 1);
+}
+
+size_t Payload::size() const {
+    return length;
+}
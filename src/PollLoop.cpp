@@ -0,0 +1,80 @@
+#include "../include/PollLoop.hpp"
+#include <cerrno>
+
+static short toPollEvents(int events) {
+    short result = 0;
+    if (events & EVENT_READ) result |= POLLIN;
+    if (events & EVENT_WRITE) result |= POLLOUT;
+    return result;
+}
+
+PollLoop::PollLoop() {
+}
+
+PollLoop::~PollLoop() {
+}
+
+int PollLoop::findIndex(int fd) const {
+    if (fd < 0 || static_cast<size_t>(fd) >= indexByFd.size())
+        return -1;
+    return indexByFd[fd];
+}
+
+bool PollLoop::add(int fd, int events) {
+    if (fd < 0 || findIndex(fd) != -1) return false;
+    
+    if (static_cast<size_t>(fd) >= indexByFd.size())
+        indexByFd.resize(fd + 1, -1);
+    indexByFd[fd] = static_cast<int>(pollFds.size());
+    
+    pollfd pfd = {fd, toPollEvents(events), 0};
+    pollFds.push_back(pfd);
+    return true;
+}
+
+bool PollLoop::modify(int fd, int events) {
+    int index = findIndex(fd);
+    if (index == -1) return false;
+    
+    pollFds[index].events = toPollEvents(events);
+    return true;
+}
+
+void PollLoop::remove(int fd) {
+    int index = findIndex(fd);
+    if (index == -1) return;
+    
+    // Order does not matter to poll(), so fill the hole with the last entry
+    pollFds[index] = pollFds.back();
+    indexByFd[pollFds[index].fd] = index;
+    pollFds.pop_back();
+    indexByFd[fd] = -1;
+}
+
+int PollLoop::wait(std::vector<IoEvent>& events, int timeoutMs) {
+    events.clear();
+    
+    int ready = poll(pollFds.data(), pollFds.size(), timeoutMs);
+    if (ready == -1)
+        return errno == EINTR ? 0 : -1;
+    
+    for (size_t i = 0; i < pollFds.size() && static_cast<int>(events.size()) < ready; ++i) {
+        short revents = pollFds[i].revents;
+        if (!revents) continue;
+        
+        IoEvent event = {pollFds[i].fd, 0, 0, NULL};
+        if (revents & POLLIN) event.events |= EVENT_READ;
+        if (revents & POLLOUT) event.events |= EVENT_WRITE;
+        if (revents & (POLLERR | POLLHUP | POLLNVAL)) event.events |= EVENT_ERROR;
+        events.push_back(event);
+    }
+    return static_cast<int>(events.size());
+}
+
+bool PollLoop::isEdgeTriggered() const {
+    return false;
+}
+
+const char* PollLoop::getName() const {
+    return "poll";
+}
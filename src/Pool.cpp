@@ -0,0 +1,18 @@
+#include "../include/Pool.hpp"
+#include <vector>
+#include <pthread.h>
+
+// Every slab stays reachable from here, so leak checkers do not flag
+// objects that sit on a free list of a thread that has exited. Never
+// destroyed: leak checks run after static destructors.
+static std::vector<void*>* slabs = new std::vector<void*>;
+static pthread_mutex_t slabLock = PTHREAD_MUTEX_INITIALIZER;
+
+void* allocateSlab(size_t bytes) {
+    void* slab = ::operator new(bytes);
+    
+    pthread_mutex_lock(&slabLock);
+    slabs->push_back(slab);
+    pthread_mutex_unlock(&slabLock);
+    return slab;
+}
@@ -0,0 +1,729 @@
+#include "../include/Reactor.hpp"
+#include "../include/Logger.hpp"
+#include <unistd.h>
+#include <fcntl.h>
+#include <cstring>
+#include <csignal>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <stdexcept>
+#include <algorithm>
+
+// Messages in flight between one reactor and the command thread
+static const size_t MAILBOX_CAPACITY = 32768;
+
+// Keepalive timers only need about a tenth of a second of precision
+static const unsigned long long TIMER_TICK_MS = 100;
+
+Reactor::Reactor(const ServerConfig& config, int listenFd, ReactorHandler* handler, bool threaded)
+    : config(config), listenFd(listenFd), tlsListenFd(-1), tlsContext(NULL), handler(handler), loop(NULL), uring(NULL),
+      timers(TIMER_TICK_MS, monotonicNanos() / 1000000), now(monotonicNanos()),
+      pingPayload(Payload::create("PING :server")), running(1),
+      inbox(NULL), outbox(NULL), threadStarted(false) {
+    loop = EventLoop::create(config.backend);
+    uring = dynamic_cast<UringLoop*>(loop);
+    if (!listenOn(listenFd))
+        throw std::runtime_error("Failed to register server socket");
+    
+    if (threaded) {
+        inbox = new Mailbox(MAILBOX_CAPACITY);
+        outbox = new Mailbox(MAILBOX_CAPACITY);
+        loop->add(inbox->getEventFd(), EVENT_READ);
+    }
+}
+
+Reactor::~Reactor() {
+    stop();
+    if (threadStarted)
+        pthread_join(thread, NULL);
+    
+    // io_uring sends still in flight point into client output
+    delete loop;
+    for (int fd = 0; fd < clients.limit(); ++fd) {
+        if (Client* client = clients.find(fd)) {
+            close(fd);
+            delete client;
+        }
+    }
+    
+    close(listenFd);
+    if (tlsListenFd != -1)
+        close(tlsListenFd);
+    pingPayload->release();
+    delete inbox;
+    delete outbox;
+}
+
+const char* Reactor::getBackendName() const {
+    return loop->getName();
+}
+
+int Reactor::getListenFd() const {
+    return listenFd;
+}
+
+const ReactorStats& Reactor::getStats() const {
+    return stats;
+}
+
+bool Reactor::listenOn(int fd) {
+    return uring ? uring->accept(fd) : loop->add(fd, EVENT_READ);
+}
+
+bool Reactor::watchClient(int fd, bool tls) {
+    // io_uring reads plaintext sockets itself; OpenSSL does its own reads,
+    // so TLS sockets stay on readiness events
+    if (uring && !tls)
+        return uring->receive(fd);
+    
+    // Edge-triggered backends keep write interest permanently: it only fires
+    // when a full socket buffer drains, so it costs nothing while idle
+    return loop->add(fd, EVENT_READ | (loop->isEdgeTriggered() ? EVENT_WRITE : 0));
+}
+
+void Reactor::listenTls(int fd, TlsContext* context) {
+    if (!listenOn(fd))
+        throw std::runtime_error("Failed to register TLS server socket");
+    tlsListenFd = fd;
+    tlsContext = context;
+}
+
+void Reactor::watch(int fd) {
+    if (!loop->add(fd, EVENT_READ))
+        throw std::runtime_error("Failed to register watched socket");
+    watched.push_back(fd);
+}
+
+void Reactor::run() {
+    while (__atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+        if (loop->wait(events, nextTimeout()) == -1)
+            throw std::runtime_error("Event loop wait failed");
+        now = monotonicNanos();
+        timers.advance(now / 1000000);
+        
+        // Only ready fds are reported, whatever the backend
+        for (size_t i = 0; i < events.size(); ++i) {
+            int fd = events[i].fd;
+            if (events[i].events & EVENT_RECEIVED) {
+                handleReceived(events[i]);
+                continue;
+            }
+            if (events[i].events & EVENT_SENT) {
+                completeSend(events[i]);
+                continue;
+            }
+            if (events[i].events & EVENT_ACCEPTED) {
+                completeAccept(events[i]);
+                continue;
+            }
+            if (fd == listenFd || fd == tlsListenFd) {
+                acceptClients(fd, fd == tlsListenFd ? tlsContext : NULL);
+                continue;
+            }
+            if (inbox && fd == inbox->getEventFd()) {
+                processInbox();
+                continue;
+            }
+            if (std::find(watched.begin(), watched.end(), fd) != watched.end()) {
+                handler->onWatchedReadable(fd);
+                continue;
+            }
+            if (events[i].events & (EVENT_READ | EVENT_ERROR))
+                handleClientData(fd);
+            
+            if (events[i].events & EVENT_WRITE) {
+                Client* client = clients.find(fd);
+                if (client && client->getTls() && !client->getTls()->isEstablished())
+                    handleClientData(fd);
+                else if (client && client->hasPendingOutput())
+                    scheduleFlush(client);
+            }
+        }
+        
+        if (!throttled.empty()) {
+            // Clients paused on a congested outbox go on once the command
+            // thread has made room; move the backlog up to find out
+            if (outbox && outbox->isCongested())
+                outbox->flush();
+            resumeThrottled();
+        }
+        
+        // Replies queued while handling this batch go out together
+        flushPending();
+        if (outbox)
+            outbox->flush();
+    }
+}
+
+void* Reactor::threadMain(void* arg) {
+    Reactor* reactor = static_cast<Reactor*>(arg);
+    try {
+        reactor->run();
+    } catch (const std::exception& e) {
+        LOG_ERROR << "Reactor error: " << e.what();
+    }
+    return NULL;
+}
+
+void Reactor::startThread() {
+    // Signals belong to the command thread; workers inherit a blocked mask
+    sigset_t all, previous;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &previous);
+    int result = pthread_create(&thread, NULL, threadMain, this);
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    
+    if (result != 0)
+        throw std::runtime_error("Failed to start reactor thread");
+    threadStarted = true;
+}
+
+void Reactor::stop() {
+    __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+    if (inbox)
+        inbox->notify();
+}
+
+void Reactor::resume() {
+    __atomic_store_n(&running, 1, __ATOMIC_RELEASE);
+}
+
+void Reactor::adopt(Client* client, const std::string& input) {
+    if (!watchClient(client->getFd(), client->getTls() != NULL))
+        throw std::runtime_error("Failed to register adopted client socket");
+    clients.insert(client->getFd(), client);
+    armKeepalive(client);
+    
+    // Leftover lines run on the first pass of the loop, like throttled ones
+    if (!input.empty()) {
+        size_t room;
+        char* buffer = client->getInput().prepareWrite(room);
+        size_t size = std::min(room, input.size());
+        memcpy(buffer, input.data(), size);
+        client->getInput().commit(size);
+        client->setThrottled(true);
+        throttled.push_back(client->getFd());
+    }
+}
+
+void Reactor::acceptClients(int fd, TlsContext* context) {
+    // Edge-triggered backends only signal once for the whole accept backlog
+    do {
+        struct sockaddr_in clientAddr;
+        socklen_t clientAddrLen = sizeof(clientAddr);
+        
+        int clientFd = accept(fd, (struct sockaddr*)&clientAddr, &clientAddrLen);
+        if (clientFd == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                LOG_ERROR << "Failed to accept client connection: " << strerror(errno);
+            return;
+        }
+        addClient(clientFd, inet_ntoa(clientAddr.sin_addr), context);
+    } while (loop->isEdgeTriggered());
+}
+
+void Reactor::completeAccept(const IoEvent& event) {
+    if (event.result < 0) {
+        LOG_ERROR << "Failed to accept client connection: " << strerror(-event.result);
+        return;
+    }
+    
+    // Multishot accept has nowhere to put each peer's address
+    struct sockaddr_in clientAddr;
+    socklen_t clientAddrLen = sizeof(clientAddr);
+    if (getpeername(event.result, (struct sockaddr*)&clientAddr, &clientAddrLen) == -1) {
+        close(event.result);
+        return;
+    }
+    addClient(event.result, inet_ntoa(clientAddr.sin_addr), event.fd == tlsListenFd ? tlsContext : NULL);
+}
+
+void Reactor::addClient(int clientFd, const char* ip, TlsContext* context) {
+    if (fcntl(clientFd, F_SETFL, O_NONBLOCK) == -1 || !watchClient(clientFd, context != NULL)) {
+        LOG_ERROR << "Failed to register client socket";
+        close(clientFd);
+        return;
+    }
+    
+    // The handshake runs on the loop's readiness events, so the client
+    // is registered right away and only its lines wait
+    TlsSession* tls = NULL;
+    if (context && !(tls = context->accept(clientFd))) {
+        LOG_ERROR << "Failed to start TLS on client socket";
+        loop->remove(clientFd);
+        close(clientFd);
+        return;
+    }
+    
+    Client* client = new Client(clientFd, ip, this, config.sendQueueLimit);
+    client->setTls(tls);
+    clients.insert(clientFd, client);
+    armKeepalive(client);
+    statAdd(stats.accepted, 1);
+    StringRef none = {NULL, 0};
+    notify(Message::CLIENT_CONNECTED, client, none);
+}
+
+void Reactor::handleClientData(int clientFd) {
+    Client* client = clients.find(clientFd);
+    if (!client || client->isClosing()) return;
+    
+    // Nothing is read as lines before the TLS handshake is through
+    TlsSession* tls = client->getTls();
+    if (tls && !tls->isEstablished() && !continueHandshake(client)) return;
+    
+    LineBuffer& input = client->getInput();
+    
+    // Edge-triggered backends require draining the socket until EAGAIN.
+    // OpenSSL may also hold decrypted input the socket will not report again.
+    do {
+        size_t room;
+        char* buffer = input.prepareWrite(room);
+        if (room == 0) {
+            // Only lines held back by flood control can fill the buffer
+            client->markClosing("Excess Flood");
+            break;
+        }
+        ssize_t bytesRead = client->receive(buffer, room);
+        
+        if (bytesRead <= 0) {
+            if (bytesRead == 0) {
+                client->markClosing("Connection closed");
+            } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                LOG_WARN << "Error receiving data: " << strerror(errno);
+                client->markClosing("Read error");
+            }
+            break;
+        }
+        commitInput(client, bytesRead);
+    } while ((loop->isEdgeTriggered() || (tls && tls->hasPendingInput())) && !client->isClosing());
+    
+    input.release();
+}
+
+void Reactor::handleReceived(const IoEvent& event) {
+    Client* client = clients.find(event.fd);
+    if (!client || client->isClosing()) return;
+    
+    if (event.result <= 0) {
+        if (event.result == 0) {
+            client->markClosing("Connection closed");
+        } else {
+            LOG_WARN << "Error receiving data: " << strerror(-event.result);
+            client->markClosing("Read error");
+        }
+        return;
+    }
+    
+    // The loop has already read into one of its ring buffers, which goes
+    // back to the kernel on the next wait: copy it into the line buffer
+    LineBuffer& input = client->getInput();
+    const char* data = event.data;
+    size_t left = event.result;
+    while (left && !client->isClosing()) {
+        size_t room;
+        char* buffer = input.prepareWrite(room);
+        if (room == 0) {
+            client->markClosing("Excess Flood");
+            break;
+        }
+        size_t size = std::min(room, left);
+        memcpy(buffer, data, size);
+        data += size;
+        left -= size;
+        commitInput(client, size);
+    }
+    input.release();
+}
+
+void Reactor::commitInput(Client* client, size_t size) {
+    client->getInput().commit(size);
+    statAdd(stats.bytesIn, size);
+    client->setLastInput(now / 1000000);
+    
+    // A throttled client's input is only buffered until it may run again
+    if (!client->isThrottled() && !processInput(client)) {
+        client->setThrottled(true);
+        throttled.push_back(client->getFd());
+        if (outbox && outbox->isCongested())
+            statAdd(stats.congested, 1);
+        else
+            statAdd(stats.throttled, 1);
+    }
+}
+
+bool Reactor::continueHandshake(Client* client) {
+    TlsSession* tls = client->getTls();
+    TlsSession::Result result = tls->handshake();
+    
+    if (result == TlsSession::OK) {
+        statAdd(stats.tlsHandshakes, 1);
+        if (tls->isResumed())
+            statAdd(stats.tlsResumed, 1);
+        if (tls->isKernelSend())
+            statAdd(stats.tlsKernelSend, 1);
+        LOG_DEBUG << "TLS established (fd: " << client->getFd() << "): " << tls->describe();
+        
+        // Output queued meanwhile could not be written yet
+        if (client->hasPendingOutput() && !client->isFlushScheduled())
+            scheduleFlush(client);
+        updateWriteInterest(client);
+        return true;
+    }
+    if (result == TlsSession::WANT_WRITE) {
+        // Level-triggered backends only report writability when asked
+        if (!loop->isEdgeTriggered() && !client->isWaitingWritable()) {
+            loop->modify(client->getFd(), EVENT_READ | EVENT_WRITE);
+            client->setWaitingWritable(true);
+        }
+        return false;
+    }
+    if (result == TlsSession::CLOSED)
+        client->markClosing("Connection closed");
+    else if (result == TlsSession::FAILED)
+        client->markClosing("TLS handshake failed");
+    return false;
+}
+
+bool Reactor::processInput(Client* client) {
+    LineBuffer& input = client->getInput();
+    TokenBucket& bucket = client->getFloodBucket();
+    bool limited = config.floodRate > 0 && !client->isServerLink();
+    
+    // Lines are handed over as views into the receive buffer. Stop
+    // feeding them once a command (QUIT) asked to close the client.
+    StringRef line;
+    while (!client->isClosing()) {
+        if (limited && !bucket.ready(now, config.floodBurst, config.floodRate))
+            return false;
+        // The command thread is behind: hold lines back like flood control
+        // does, so a busy reactor cannot grow the outbox without bound
+        if (outbox && outbox->isCongested())
+            return false;
+        
+        LineBuffer::Status status = input.nextLine(line);
+        if (status == LineBuffer::NO_LINE)
+            break;
+        
+        if (status == LineBuffer::LINE) {
+            statAdd(stats.linesIn, 1);
+            if (limited)
+                bucket.take(handler->getLineCost(line));
+            notify(Message::CLIENT_LINE, client, line);
+        } else {
+            if (limited)
+                bucket.take(1);
+            StringRef none = {NULL, 0};
+            notify(Message::CLIENT_INPUT_TOO_LONG, client, none);
+        }
+    }
+    return true;
+}
+
+void Reactor::resumeThrottled() {
+    size_t kept = 0;
+    for (size_t i = 0; i < throttled.size(); ++i) {
+        Client* client = clients.find(throttled[i]);
+        if (!client || !client->isThrottled() || client->isClosed()) continue;
+        
+        if (!client->isClosing() && !processInput(client)) {
+            throttled[kept++] = throttled[i];
+            continue;
+        }
+        client->setThrottled(false);
+        client->getInput().release();
+    }
+    throttled.resize(kept);
+}
+
+int Reactor::throttleTimeout() const {
+    if (throttled.empty()) return -1;
+    // The command thread wakes us once it has drained a congested outbox
+    if (outbox && outbox->isCongested()) return -1;
+    if (!config.floodRate) return 0;
+    
+    // Wake up for the first throttled client whose bucket refills
+    unsigned long long soonest = ~0ULL;
+    for (size_t i = 0; i < throttled.size(); ++i) {
+        Client* client = clients.find(throttled[i]);
+        if (client)
+            soonest = std::min(soonest, client->getFloodBucket().nanosUntilReady(config.floodRate));
+    }
+    if (soonest == ~0ULL) return 0;
+    return static_cast<int>(soonest / 1000000) + 1;
+}
+
+int Reactor::nextTimeout() const {
+    int timer = timers.nextTimeout(now / 1000000);
+    int throttle = throttleTimeout();
+    if (timer < 0) return throttle;
+    if (throttle < 0) return timer;
+    return std::min(timer, throttle);
+}
+
+void Reactor::armKeepalive(Client* client) {
+    Timer& keepalive = client->getKeepalive();
+    keepalive.handler = this;
+    keepalive.data = client;
+    client->setLastInput(now / 1000000);
+    
+    if (config.registrationTimeout)
+        timers.schedule(&keepalive, config.registrationTimeout * 1000);
+    else if (config.pingInterval)
+        timers.schedule(&keepalive, config.pingInterval * 1000);
+}
+
+void Reactor::onTimer(Timer* timer) {
+    Client* client = static_cast<Client*>(timer->data);
+    if (client->isClosing()) return;
+    
+    if (config.registrationTimeout && !client->isAuthenticated()) {
+        client->markClosing("Registration timeout");
+        return;
+    }
+    if (!config.pingInterval) return;
+    
+    // Any input counts as an answer, not only PONG
+    unsigned long long nowMs = now / 1000000;
+    unsigned long long pingSent = client->getPingSent();
+    if (pingSent && client->getLastInput() < pingSent) {
+        if (nowMs - pingSent >= config.pingTimeout * 1000) {
+            client->markClosing("Ping timeout");
+            return;
+        }
+        timers.schedule(timer, pingSent + config.pingTimeout * 1000 - nowMs);
+        return;
+    }
+    
+    unsigned long long idle = nowMs - client->getLastInput();
+    if (idle >= config.pingInterval * 1000) {
+        queueOutput(client, pingPayload);
+        client->setPingSent(nowMs);
+        timers.schedule(timer, config.pingTimeout * 1000);
+    } else {
+        client->setPingSent(0);
+        timers.schedule(timer, config.pingInterval * 1000 - idle);
+    }
+}
+
+void Reactor::scheduleFlush(Client* client) {
+    client->setFlushScheduled(true);
+    pendingFlush.push_back(client->getFd());
+}
+
+void Reactor::flushPending() {
+    // Closing a client broadcasts QUIT and may schedule more flushes,
+    // so the list can grow while we walk it
+    for (size_t i = 0; i < pendingFlush.size(); ++i) {
+        Client* client = clients.find(pendingFlush[i]);
+        if (!client || client->isClosed()) continue;
+        
+        client->setFlushScheduled(false);
+        
+        if (client->isClosing()) {
+            closeClient(client);
+            continue;
+        }
+        if (uring && !client->getTls()) {
+            startSend(client);
+            continue;
+        }
+        if (!flushClient(client)) {
+            closeClient(client);
+            continue;
+        }
+        updateWriteInterest(client);
+    }
+    pendingFlush.clear();
+}
+
+bool Reactor::flushClient(Client* client) {
+    size_t before = client->getSendQueueBytes();
+    bool ok = client->flushSendQueue();
+    size_t written = before - client->getSendQueueBytes();
+    statAdd(stats.bytesOut, written);
+    statSub(stats.sendqBytes, written);
+    return ok;
+}
+
+void Reactor::startSend(Client* client) {
+    // At most one send per client is in flight; its completion starts the
+    // next. All of them go to the kernel with the loop's next wait.
+    if (!client->hasPendingOutput()) return;
+    struct iovec* iov = uring->prepareSend(client->getFd());
+    if (iov && !uring->send(client->getFd(), client->gatherOutput(iov, UringLoop::MAX_SEND_IOV)))
+        client->markClosing("Write error");
+}
+
+void Reactor::completeSend(const IoEvent& event) {
+    Client* client = clients.find(event.fd);
+    if (!client || client->isClosed()) return;
+    
+    if (event.result < 0) {
+        client->markClosing("Write error");
+        return;
+    }
+    client->consumeOutput(event.result);
+    statAdd(stats.bytesOut, event.result);
+    statSub(stats.sendqBytes, event.result);
+    
+    if (client->hasPendingOutput() && !client->isFlushScheduled())
+        scheduleFlush(client);
+}
+
+void Reactor::queueOutput(Client* client, Payload* payload) {
+    size_t before = client->getSendQueueBytes();
+    client->appendOutput(payload);
+    size_t after = client->getSendQueueBytes();
+    if (after == before) return;
+    
+    statAdd(stats.messagesOut, 1);
+    statAdd(stats.sendqBytes, after - before);
+    if (after > stats.sendqPeak)
+        statAdd(stats.sendqPeak, after - stats.sendqPeak);
+}
+
+void Reactor::updateWriteInterest(Client* client) {
+    // Level-triggered backends must only watch for writability while blocked
+    if (loop->isEdgeTriggered()) return;
+    
+    bool blocked = client->hasPendingOutput();
+    if (blocked != client->isWaitingWritable()) {
+        loop->modify(client->getFd(), blocked ? EVENT_READ | EVENT_WRITE : EVENT_READ);
+        client->setWaitingWritable(blocked);
+    }
+}
+
+void Reactor::closeClient(Client* client) {
+    int fd = client->getFd();
+    
+    // Best-effort goodbye; whatever does not fit in the socket buffer is dropped.
+    // An io_uring send still in flight owns the head of the queue: skip it then.
+    timers.cancel(&client->getKeepalive());
+    if (!uring || !uring->isSending(fd))
+        flushClient(client);
+    if (client->getTls())
+        client->getTls()->shutdown();
+    statSub(stats.sendqBytes, client->getSendQueueBytes());
+    client->setClosed();
+    loop->remove(fd);
+    StringRef reason = {client->getCloseReason().data(), client->getCloseReason().size()};
+    notify(Message::CLIENT_CLOSED, client, reason);
+    
+    if (outbox) {
+        // The command thread still holds the pointer until it sends RELEASE;
+        // keeping the fd open meanwhile stops it from being reused
+        shutdown(fd, SHUT_RDWR);
+        return;
+    }
+    
+    clients.erase(fd);
+    close(fd);
+    delete client;
+}
+
+void Reactor::notify(Message::Type type, Client* client, const StringRef& text) {
+    if (!outbox) {
+        if (type == Message::CLIENT_CONNECTED) handler->onClientConnected(client);
+        else if (type == Message::CLIENT_LINE) handler->onClientLine(client, text);
+        else if (type == Message::CLIENT_INPUT_TOO_LONG) handler->onClientInputTooLong(client);
+        else handler->onClientClosed(client, text.str());
+        return;
+    }
+    
+    // Crossing threads is the one place a line gets copied
+    Message message = {type, client, NULL, text.data ? new std::string(text.data, text.size) : NULL};
+    outbox->post(message);
+}
+
+void Reactor::processInbox() {
+    inbox->acknowledge();
+    
+    Message message;
+    while (inbox->receive(message)) {
+        Client* client = message.client;
+        if (message.type == Message::ATTACH) {
+            adopt(client, "");
+        } else if (message.type == Message::DELIVER) {
+            queueOutput(client, message.payload);
+            message.payload->release();
+        } else if (message.type == Message::DISCONNECT) {
+            client->markClosing(*message.text);
+            delete message.text;
+        } else if (message.type == Message::RELEASE) {
+            clients.erase(client->getFd());
+            close(client->getFd());
+            delete client;
+        }
+    }
+    
+    if (inbox->takeBlocked())
+        outbox->notify();
+}
+
+void Reactor::attach(Client* client) {
+    if (!inbox) {
+        adopt(client, "");
+        return;
+    }
+    
+    Message message = {Message::ATTACH, client, NULL, NULL};
+    inbox->post(message);
+}
+
+void Reactor::deliver(Client* client, Payload* payload) {
+    if (!inbox) {
+        queueOutput(client, payload);
+        return;
+    }
+    
+    payload->retain();
+    Message message = {Message::DELIVER, client, payload, NULL};
+    inbox->post(message);
+}
+
+void Reactor::disconnect(Client* client, const std::string& reason) {
+    if (!inbox) {
+        client->markClosing(reason);
+        return;
+    }
+    
+    Message message = {Message::DISCONNECT, client, NULL, new std::string(reason)};
+    inbox->post(message);
+}
+
+int Reactor::getEventFd() const {
+    return outbox->getEventFd();
+}
+
+void Reactor::dispatchEvents() {
+    outbox->acknowledge();
+    
+    Message message;
+    while (outbox->receive(message)) {
+        if (message.type == Message::CLIENT_CONNECTED) {
+            handler->onClientConnected(message.client);
+        } else if (message.type == Message::CLIENT_LINE) {
+            StringRef line = {message.text->data(), message.text->size()};
+            handler->onClientLine(message.client, line);
+            delete message.text;
+        } else if (message.type == Message::CLIENT_INPUT_TOO_LONG) {
+            handler->onClientInputTooLong(message.client);
+        } else if (message.type == Message::CLIENT_CLOSED) {
+            handler->onClientClosed(message.client, *message.text);
+            delete message.text;
+            
+            // The command thread is done with the client; the reactor may free it
+            Message release = {Message::RELEASE, message.client, NULL, NULL};
+            inbox->post(release);
+        }
+    }
+    
+    if (outbox->takeBlocked())
+        inbox->notify();
+}
+
+void Reactor::wake() {
+    inbox->flush();
+}
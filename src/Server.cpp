@@ -1,7 +1,7 @@
 #include "../include/Server.hpp"
 #include "../include/utils.hpp"
 #include "../include/Command.hpp"
-#include <iostream>
+#include "../include/Logger.hpp"
 #include <unistd.h>
 #include <fcntl.h>
 #include <cstring>
@@ -9,176 +9,345 @@
 #include <arpa/inet.h>
 #include <cerrno>
 #include <cstdlib>
+#include <stdexcept>
+#include <sstream>
+#include <cstdio>
+#include <algorithm>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <csignal>
 
-Server::Server(int port, const std::string& password)
-    : port(port), password(password), serverSocket(-1) {}
+// Indexed by findCommand(); keep the two in sync
+enum {
+    CMD_PASS, CMD_NICK, CMD_USER, CMD_JOIN, CMD_PRIVMSG, CMD_KICK, CMD_PART,
+    CMD_TOPIC, CMD_MODE, CMD_INVITE, CMD_QUIT, CMD_PING, CMD_OPER, CMD_STATS,
+    CMD_NAMES, CMD_PONG, CMD_UPGRADE, CMD_SERVER, CMD_NONE
+};
+
+// Room kept for the requester's nickname when NAMES replies are split, so
+// the cached chunks fit every client with a nickname up to this length
+static const size_t NAMES_NICK_RESERVE = 30;
+
+// Format tag of the upgrade state; bump it when the layout changes
+static const char* STATE_MAGIC = "ircserv-state-1";
+
+// How long the old process waits for its successor to take over
+static const int UPGRADE_TIMEOUT_MS = 10000;
+
+// "<prefix> <verb> [<target>] :<trailing>" from the client's cached
+// prefix, sized up front so it is built in one allocation
+static std::string relayLine(Client* source, const char* verb, const std::string& target,
+                             const std::string& trailing) {
+    const std::string& prefix = source->getPrefix();
+    std::string line;
+    line.reserve(prefix.size() + strlen(verb) + target.size() + trailing.size() + 4);
+    line += prefix;
+    line += ' ';
+    line += verb;
+    if (!target.empty()) {
+        line += ' ';
+        line += target;
+    }
+    line += " :";
+    line += trailing;
+    return line;
+}
+
+Server::Server(int port, const std::string& password, const ServerConfig& config)
+    : port(port), password(password), config(config), running(1), reactorsReady(0), commandLoop(NULL),
+      tlsContext(NULL), commandStats(CMD_NONE + 1), startTime(time(NULL)), statsFd(-1),
+      upgradeRequested(0), handedOff(false), serverName(config.serverName), linkTimerFd(-1) {
+    // Peers tell servers apart by name; the port keeps local setups distinct
+    if (serverName.empty()) {
+        std::ostringstream name;
+        name << "ircserv." << port;
+        serverName = name.str();
+    }
+}
 
 Server::~Server() {
-    if (serverSocket != -1) close(serverSocket);
+    // Reactors own the client objects and join their threads on delete
+    for (size_t i = 0; i < reactors.size(); ++i)
+        reactors[i]->stop();
+    for (size_t i = 0; i < reactors.size(); ++i)
+        delete reactors[i];
+    delete commandLoop;
+    delete tlsContext;
     
-    std::map<int, Client*>::iterator it;
-    for (it = clients.begin(); it != clients.end(); ++it)
-        delete it->second;
+    if (statsFd != -1) {
+        close(statsFd);
+        unlink(config.statsSocket.c_str());
+    }
+    if (linkTimerFd != -1)
+        close(linkTimerFd);
     
     std::map<std::string, Channel*>::iterator it2;
     for (it2 = channels.begin(); it2 != channels.end(); ++it2)
         delete it2->second;
+    for (std::set<Client*>::iterator it = remoteUsers.begin(); it != remoteUsers.end(); ++it)
+        delete *it;
 }
 
-void Server::setupSocket() {
-    serverSocket = socket(AF_INET, SOCK_STREAM, 0);
+int Server::createListener(int listenPort) {
+    int serverSocket = socket(AF_INET, SOCK_STREAM, 0);
     if (serverSocket == -1)
         throw std::runtime_error("Failed to create socket");
     
+    // With several reactors each gets its own socket on the same port and
+    // the kernel spreads incoming connections between them
     int opt = 1;
     if (setsockopt(serverSocket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1 ||
-        fcntl(serverSocket, F_SETFL, O_NONBLOCK) == -1)
+        (config.threads > 1 && setsockopt(serverSocket, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) == -1) ||
+        fcntl(serverSocket, F_SETFL, O_NONBLOCK) == -1) {
+        close(serverSocket);
         throw std::runtime_error("Failed to set socket options");
+    }
     
     struct sockaddr_in serverAddr;
     memset(&serverAddr, 0, sizeof(serverAddr));
     serverAddr.sin_family = AF_INET;
     serverAddr.sin_addr.s_addr = INADDR_ANY;
-    serverAddr.sin_port = htons(port);
+    serverAddr.sin_port = htons(listenPort);
     
-    if (bind(serverSocket, (struct sockaddr*)&serverAddr, sizeof(serverAddr)) == -1)
+    if (bind(serverSocket, (struct sockaddr*)&serverAddr, sizeof(serverAddr)) == -1) {
+        close(serverSocket);
         throw std::runtime_error("Failed to bind socket");
+    }
     
-    if (listen(serverSocket, 10) == -1)
+    if (listen(serverSocket, SOMAXCONN) == -1) {
+        close(serverSocket);
         throw std::runtime_error("Failed to listen on socket");
-    
-    std::cout << "Server listening on port " << port << std::endl;
-    
-    pollfd pfd = {serverSocket, POLLIN, 0};
-    pollFds.push_back(pfd);
+    }
+    return serverSocket;
 }
 
-void Server::acceptClient() {
-    struct sockaddr_in clientAddr;
-    socklen_t clientAddrLen = sizeof(clientAddr);
-    
-    int clientFd = accept(serverSocket, (struct sockaddr*)&clientAddr, &clientAddrLen);
-    if (clientFd == -1) {
-        if (errno != EAGAIN && errno != EWOULDBLOCK)
-            std::cerr << "Failed to accept client connection: " << strerror(errno) << std::endl;
+void Server::detachClient(Client* client, const std::string& reason) {
+    linkCandidates.erase(client);
+    if (client->isServerLink()) {
+        dropLink(client, reason);
+        client->setDetached(true);
         return;
     }
     
-    if (fcntl(clientFd, F_SETFL, O_NONBLOCK) == -1) {
-        std::cerr << "Failed to set client socket to non-blocking mode" << std::endl;
-        close(clientFd);
-        return;
-    }
+    // Other servers hear of every registered user leaving; a remote one's
+    // own server already knows
+    std::string quitMsg = relayLine(client, "QUIT", "", reason);
+    broadcastToPeers(client, quitMsg, false);
+    if (client->isAuthenticated())
+        propagate(quitMsg, client->getRoute());
     
-    pollfd pfd = {clientFd, POLLIN, 0};
-    pollFds.push_back(pfd);
+    // Only the channels this client joined are touched; copy since removal edits the set
+    std::set<Channel*> joined = client->getChannels();
+    for (std::set<Channel*>::iterator it = joined.begin(); it != joined.end(); ++it) {
+        Channel* channel = *it;
+        channel->removeClient(client);
+        if (channel->getMemberCount() == 0)
+            removeChannel(channel->getName());
+    }
     
-    std::string clientIP = inet_ntoa(clientAddr.sin_addr);
-    clients[clientFd] = new Client(clientFd, clientIP);
+    // Invites never taken up would otherwise outlive the client, and pass
+    // to whoever is allocated at its address next
+    std::set<Channel*> invites = client->getInvites();
+    for (std::set<Channel*>::iterator it = invites.begin(); it != invites.end(); ++it)
+        (*it)->removeInvited(client);
     
-    std::cout << "New client connected from " << clientIP << " (fd: " << clientFd << ")" << std::endl;
+    setClientNickname(client, "");
+    client->setDetached(true);
 }
 
-void Server::removeClient(int clientFd) {
-    if (clients.find(clientFd) == clients.end()) return;
-    
-    Client* client = clients[clientFd];
-    
-    // Remove client from all channels
-    std::map<std::string, Channel*>::iterator chanIt;
-    for (chanIt = channels.begin(); chanIt != channels.end(); ++chanIt)
-        chanIt->second->removeClient(client);
-    
-    // Clean up empty channels
-    std::vector<std::string> emptyChannels;
-    for (chanIt = channels.begin(); chanIt != channels.end(); ++chanIt) {
-        if (chanIt->second->getClients().empty())
-            emptyChannels.push_back(chanIt->first);
-    }
-    
-    for (size_t i = 0; i < emptyChannels.size(); ++i)
-        removeChannel(emptyChannels[i]);
-    
-    std::cout << "Client disconnected (fd: " << clientFd << ")" << std::endl;
-    delete client;
-    clients.erase(clientFd);
-    
-    // Remove from poll array
-    for (size_t i = 0; i < pollFds.size(); ++i) {
-        if (pollFds[i].fd == clientFd) {
-            pollFds.erase(pollFds.begin() + i);
-            break;
+void Server::broadcastToPeers(Client* client, const std::string& message, bool includeSelf) {
+    // Everyone local sharing a channel with the client gets the message once
+    std::set<Client*> recipients;
+    const std::set<Channel*>& joined = client->getChannels();
+    for (std::set<Channel*>::const_iterator it = joined.begin(); it != joined.end(); ++it) {
+        const std::vector<Member>& members = (*it)->getMembers();
+        for (size_t i = 0; i < members.size(); ++i) {
+            if (!members[i].client->isRemote())
+                recipients.insert(members[i].client);
         }
     }
     
-    close(clientFd);
+    if (includeSelf)
+        recipients.insert(client);
+    else
+        recipients.erase(client);
+    
+    Payload* payload = Payload::create(message);
+    for (std::set<Client*>::iterator it = recipients.begin(); it != recipients.end(); ++it)
+        (*it)->queueMessage(payload);
+    payload->release();
 }
 
-void Server::handleClientData(int clientFd) {
-    Client* client = clients[clientFd];
-    char buffer[1024];
+void Server::disconnectClient(Client* client, const std::string& reason) {
+    detachClient(client, reason);
     
-    ssize_t bytesRead = recv(clientFd, buffer, sizeof(buffer) - 1, 0);
+    // The reactor sends what it can of the goodbye, then closes the socket
+    client->queueMessage("ERROR :Closing Link: " + client->getIp() + " (" + reason + ")");
+    client->disconnect(reason);
+}
+
+void Server::onClientConnected(Client* client) {
+    clients.insert(client->getFd(), client);
+    LOG_INFO << "New client connected from " << client->getIp() << " (fd: " << client->getFd() << ")";
+}
+
+void Server::onClientLine(Client* client, const StringRef& line) {
+    // Lines may still arrive from the reactor after QUIT was processed
+    if (!client->isDetached())
+        executeCommand(client, line);
+}
+
+void Server::onClientInputTooLong(Client* client) {
+    if (client->isDetached()) return;
     
-    if (bytesRead <= 0) {
-        if (bytesRead == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
-            if (bytesRead < 0) 
-                std::cerr << "Error receiving data: " << strerror(errno) << std::endl;
-            removeClient(clientFd);
-        }
-        return;
+    // ERR_INPUTTOOLONG: the line was dropped, the connection stays usable
+    std::string nick = client->getNickname().empty() ? "*" : client->getNickname();
+    client->queueMessage(":server 417 " + nick + " :Input line was too long");
+}
+
+unsigned Server::getLineCost(const StringRef& line) const {
+    // Unknown commands cost a line like anything else
+    const CommandEntry* entry = findCommand(peekCommand(line.data, line.size));
+    return entry ? entry->cost : 1;
+}
+
+void Server::onClientClosed(Client* client, const std::string& reason) {
+    // Socket-side reasons are a fixed set; server-initiated ones were counted earlier
+    if (!client->isDetached()) {
+        countDisconnect(reason);
+        detachClient(client, reason);
     }
     
-    buffer[bytesRead] = '\0';
-    client->appendBuffer(buffer);
-    
-    // Process completed commands
-    std::vector<std::string> commands = client->getCompletedCommands();
-    for (size_t i = 0; i < commands.size(); ++i)
-        executeCommand(client, commands[i]);
+    LOG_INFO << "Client disconnected (fd: " << client->getFd() << "): " << reason;
+    clients.erase(client->getFd());
 }
 
 void Server::start() {
     try {
-        setupSocket();
-        std::cout << "IRC Server started successfully!" << std::endl;
+        if (!config.stateFile.empty())
+            store.open(config.stateFile);
         
-        while (true) {
-            int ready = poll(pollFds.data(), pollFds.size(), -1);
-            
-            if (ready == -1) {
-                if (errno == EINTR) continue;
-                throw std::runtime_error("Poll failed");
+        if (config.upgradeFd != -1) {
+            restoreState(config.upgradeFd);
+        } else {
+            if (config.tlsPort)
+                tlsContext = new TlsContext(config.tlsCert, config.tlsKey);
+            for (int i = 0; i < config.threads; ++i) {
+                reactors.push_back(new Reactor(config, createListener(port), this, config.threads > 1));
+                if (tlsContext)
+                    reactors.back()->listenTls(createListener(config.tlsPort), tlsContext);
             }
+        }
+        
+        // From here on the signal handlers may touch `reactors`. A stop
+        // that came earlier only cleared `running`, so honour it now
+        __atomic_store_n(&reactorsReady, 1, __ATOMIC_SEQ_CST);
+        if (!__atomic_load_n(&running, __ATOMIC_SEQ_CST)) return;
+        
+        LOG_INFO << "Server listening on port " << port;
+        if (tlsContext)
+            LOG_INFO << "TLS listening on port " << config.tlsPort;
+        LOG_INFO << "IRC Server started successfully! (" << config.threads << " x " 
+                 << reactors[0]->getBackendName() << " event loop)";
+        
+        openStatsSocket();
+        openLinkTimer();
+        
+        if (reactors.size() == 1) {
+            if (statsFd != -1)
+                reactors[0]->watch(statsFd);
+            if (linkTimerFd != -1)
+                reactors[0]->watch(linkTimerFd);
             
-            if (pollFds[0].revents & POLLIN)
-                acceptClient();
-            
-            for (size_t i = 1; i < pollFds.size(); ++i) {
-                if (pollFds[i].revents & POLLIN)
-                    handleClientData(pollFds[i].fd);
+            // run() also returns when an upgrade was requested; if the
+            // successor does not take over, carry on serving
+            for (;;) {
+                reactors[0]->run();
+                if (!running || !upgradeRequested) return;
+                upgradeRequested = 0;
+                if (handOver()) {
+                    handedOff = true;
+                    return;
+                }
+                noticeOpers("Upgrade failed, still running the current binary");
+                reactors[0]->resume();
             }
         }
+        
+        for (size_t i = 0; i < reactors.size(); ++i)
+            reactors[i]->startThread();
+        runCommandLoop();
     } catch (const std::exception& e) {
-        std::cerr << "Server error: " << e.what() << std::endl;
+        LOG_ERROR << "Server error: " << e.what();
     }
 }
 
-void Server::broadcast(const std::string& message, int excludeFd) {
-    std::map<int, Client*>::iterator it;
-    for (it = clients.begin(); it != clients.end(); ++it) {
-        if (it->first != excludeFd && it->second->isAuthenticated()) {
-            sendToClient(it->first, message);
+void Server::runCommandLoop() {
+    // Commands run here; reactor threads only do socket I/O and framing
+    // It only watches eventfds, which io_uring would not do any cheaper
+    commandLoop = EventLoop::create(config.backend == "uring" ? "epoll" : config.backend);
+    for (size_t i = 0; i < reactors.size(); ++i)
+        commandLoop->add(reactors[i]->getEventFd(), EVENT_READ);
+    if (statsFd != -1)
+        commandLoop->add(statsFd, EVENT_READ);
+    if (linkTimerFd != -1)
+        commandLoop->add(linkTimerFd, EVENT_READ);
+    
+    while (running) {
+        if (commandLoop->wait(events, -1) == -1)
+            throw std::runtime_error("Event loop wait failed");
+        
+        for (size_t i = 0; i < events.size(); ++i) {
+            if (events[i].fd == statsFd) {
+                serveStats();
+                continue;
+            }
+            if (events[i].fd == linkTimerFd) {
+                connectLinks();
+                continue;
+            }
+            for (size_t j = 0; j < reactors.size(); ++j) {
+                if (reactors[j]->getEventFd() == events[i].fd)
+                    reactors[j]->dispatchEvents();
+            }
         }
+        
+        // One wakeup per reactor for everything this batch sent its way
+        for (size_t i = 0; i < reactors.size(); ++i)
+            reactors[i]->wake();
+    }
+}
+
+void Server::requestUpgrade() {
+    if (config.threads != 1 || !__atomic_load_n(&reactorsReady, __ATOMIC_SEQ_CST)) return;
+    upgradeRequested = 1;
+    reactors[0]->stop();
+}
+
+bool Server::hasHandedOff() const {
+    return handedOff;
+}
+
+void Server::stop() {
+    // Called from the signal handler: only flags and eventfd writes
+    __atomic_store_n(&running, 0, __ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&reactorsReady, __ATOMIC_SEQ_CST)) return;
+    for (size_t i = 0; i < reactors.size(); ++i)
+        reactors[i]->stop();
+}
+
+void Server::broadcast(const std::string& message, int excludeFd) {
+    for (int fd = 0; fd < clients.limit(); ++fd) {
+        Client* client = clients.find(fd);
+        if (client && fd != excludeFd && client->isAuthenticated())
+            client->queueMessage(message);
     }
 }
 
 void Server::sendToClient(int clientFd, const std::string& message) {
-    std::string fullMessage = message;
-    if (fullMessage.find("\r\n") == std::string::npos)
-        fullMessage += "\r\n";
-    
-    send(clientFd, fullMessage.c_str(), fullMessage.size(), 0);
+    Client* client = clients.find(clientFd);
+    if (client)
+        client->queueMessage(message);
 }
 
 Channel* Server::getChannel(const std::string& name) {
@@ -195,93 +364,218 @@ Channel* Server::createChannel(const std::string& name, Client* creator) {
 void Server::removeChannel(const std::string& name) {
     std::map<std::string, Channel*>::iterator it = channels.find(name);
     if (it != channels.end()) {
-        delete it->second;
+        // `name` may be the channel's own name, so log before deleting it
+        LOG_INFO << "Channel " << name << " removed";
+        Channel* channel = it->second;
         channels.erase(it);
-        std::cout << "Channel " << name << " removed" << std::endl;
+        std::set<Client*> invited = channel->getInvited();
+        for (std::set<Client*>::iterator inv = invited.begin(); inv != invited.end(); ++inv)
+            channel->removeInvited(*inv);
+        delete channel;
     }
 }
 
 Client* Server::getClientByNickname(const std::string& nickname) {
-    std::map<int, Client*>::iterator it;
-    for (it = clients.begin(); it != clients.end(); ++it) {
-        if (it->second->getNickname() == nickname)
-            return it->second;
-    }
-    return NULL;
+    std::tr1::unordered_map<std::string, Client*>::iterator it = nicknames.find(ircCaseFold(nickname));
+    return (it != nicknames.end()) ? it->second : NULL;
+}
+
+void Server::setClientNickname(Client* client, const std::string& nickname) {
+    if (!client->getNickname().empty())
+        nicknames.erase(ircCaseFold(client->getNickname()));
+    
+    client->setNickname(nickname);
+    const std::set<Channel*>& joined = client->getChannels();
+    for (std::set<Channel*>::const_iterator it = joined.begin(); it != joined.end(); ++it)
+        (*it)->invalidateNames();
+    if (!nickname.empty())
+        nicknames[ircCaseFold(nickname)] = client;
 }
 
 const std::string& Server::getPassword() const {
     return password;
 }
 
-void Server::executeCommand(Client* client, const std::string& commandStr) {
-    Command command(commandStr);
-    std::string cmd = toUpper(command.getCommand());
-    int fd = client->getFd();
-    
-    std::cout << "Client " << fd << " sent command: " << cmd << std::endl;
+// Costs are in flood control units: commands that fan out or render
+// lists cost more, and OPER is expensive to slow down password guessing
+const Server::CommandEntry Server::commandTable[] = {
+    {"PASS", &Server::handlePass, 1, false, 1},
+    {"NICK", &Server::handleNick, 0, false, 2},
+    {"USER", &Server::handleUser, 4, false, 1},
+    {"JOIN", &Server::handleJoin, 1, true, 2},
+    {"PRIVMSG", &Server::handlePrivmsg, 2, true, 1},
+    {"KICK", &Server::handleKick, 2, true, 2},
+    {"PART", &Server::handlePart, 1, true, 1},
+    {"TOPIC", &Server::handleTopic, 1, true, 1},
+    {"MODE", &Server::handleMode, 1, true, 1},
+    {"INVITE", &Server::handleInvite, 2, true, 2},
+    {"QUIT", &Server::handleQuit, 0, true, 1},
+    {"PING", &Server::handlePing, 0, true, 1},
+    {"OPER", &Server::handleOper, 2, true, 5},
+    {"STATS", &Server::handleStats, 0, true, 5},
+    {"NAMES", &Server::handleNames, 0, true, 3},
+    {"PONG", &Server::handlePong, 0, false, 1},
+    {"UPGRADE", &Server::handleUpgrade, 0, true, 5},
+    {"SERVER", &Server::handleServer, 1, false, 1}
+};
+
+// Picks the only possible entry from the length and a distinguishing
+// letter, then confirms it with a case-insensitive compare
+const Server::CommandEntry* Server::findCommand(const StringRef& name) {
+    int index = CMD_NONE;
     
-    if (!client->isAuthenticated()) {
-        // Authentication commands
-        if (cmd == "PASS") {
-            if (command.getParams().empty()) {
-                sendToClient(fd, ":server 461 PASS :Not enough parameters");
-                return;
-            }
-            
-            if (command.getParams()[0] == password) {
-                client->setPassOk(true);
-                std::cout << "Client " << fd << " password accepted" << std::endl;
-            } else {
-                sendToClient(fd, ":server 464 :Password incorrect");
-            }
-        } else if (cmd == "NICK") {
-            if (command.getParams().empty()) {
-                sendToClient(fd, ":server 431 :No nickname given");
-                return;
-            }
-            
-            std::string nickname = command.getParams()[0];
-            if (getClientByNickname(nickname)) {
-                sendToClient(fd, ":server 433 " + nickname + " :Nickname is already in use");
-                return;
-            }
-            
-            client->setNickname(nickname);
-            std::cout << "Client " << fd << " set nickname to " << nickname << std::endl;
-            
-            checkAuthentication(client);
-        } else if (cmd == "USER") {
-            if (command.getParams().size() < 4) {
-                sendToClient(fd, ":server 461 USER :Not enough parameters");
-                return;
+    switch (name.size) {
+    case 4:
+        switch (name.data[0] | 0x20) {
+        case 'p':
+            switch (name.data[1] | 0x20) {
+            case 'a': index = ((name.data[2] | 0x20) == 's') ? CMD_PASS : CMD_PART; break;
+            case 'i': index = CMD_PING; break;
+            case 'o': index = CMD_PONG; break;
             }
-            
-            client->setUsername(command.getParams()[0]);
-            client->setRealname(command.getParams()[3]);
-            std::cout << "Client " << fd << " set username to " << command.getParams()[0] << std::endl;
-            
-            checkAuthentication(client);
-        } else {
-            sendToClient(fd, ":server 451 :You have not registered");
+            break;
+        case 'n': index = CMD_NICK; break;
+        case 'u': index = CMD_USER; break;
+        case 'j': index = CMD_JOIN; break;
+        case 'k': index = CMD_KICK; break;
+        case 'm': index = CMD_MODE; break;
+        case 'q': index = CMD_QUIT; break;
+        case 'o': index = CMD_OPER; break;
         }
-    } else {
-        // Authenticated commands
-        if (cmd == "JOIN") handleJoin(client, command);
-        else if (cmd == "PRIVMSG") handlePrivmsg(client, command);
-        else if (cmd == "KICK") handleKick(client, command);
-        else if (cmd == "PART") handlePart(client, command);
-        else if (cmd == "TOPIC") handleTopic(client, command);
-        else if (cmd == "MODE") handleMode(client, command);
-        else if (cmd == "INVITE") handleInvite(client, command);
-        else if (cmd == "QUIT") handleQuit(client, command);
-        else if (cmd == "PING") {
-            std::string token = command.getParams().empty() ? "" : command.getParams()[0];
-            sendToClient(fd, "PONG server " + token);
-        } else {
-            sendToClient(fd, ":server 421 " + cmd + " :Unknown command");
+        break;
+    case 5:
+        switch (name.data[0] | 0x20) {
+        case 's': index = CMD_STATS; break;
+        case 't': index = CMD_TOPIC; break;
+        case 'n': index = CMD_NAMES; break;
         }
+        break;
+    case 6: index = ((name.data[0] | 0x20) == 's') ? CMD_SERVER : CMD_INVITE; break;
+    case 7: index = ((name.data[0] | 0x20) == 'u') ? CMD_UPGRADE : CMD_PRIVMSG; break;
     }
+    
+    if (index == CMD_NONE || !name.equalsIgnoreCase(commandTable[index].name))
+        return NULL;
+    return &commandTable[index];
+}
+
+void Server::executeCommand(Client* client, const StringRef& line) {
+    // Empty lines are silently ignored
+    MessageView message;
+    if (!parseMessage(line.data, line.size, message))
+        return;
+    
+    // Peer servers speak the link protocol
+    if (client->isServerLink()) {
+        handleLinkLine(client, message, line);
+        return;
+    }
+    
+    const CommandEntry* entry = findCommand(message.command);
+    int fd = client->getFd();
+    
+    LOG_DEBUG << "Client " << fd << " sent command: " << message.command;
+    
+    if (!client->isAuthenticated() && (!entry || entry->requiresRegistration)) {
+        sendToClient(fd, ":server 451 :You have not registered");
+        return;
+    }
+    
+    if (!entry) {
+        ++commandStats[CMD_NONE].calls;
+        sendToClient(fd, ":server 421 " + message.command.str() + " :Unknown command");
+        return;
+    }
+    
+    if (message.paramCount < entry->minParams) {
+        sendToClient(fd, std::string(":server 461 ") + entry->name + " :Not enough parameters");
+        return;
+    }
+    
+    CommandStats& stats = commandStats[entry - commandTable];
+    unsigned long long started = monotonicNanos();
+    
+    Command command(message);
+    (this->*entry->handler)(client, command);
+    
+    ++stats.calls;
+    stats.latency.record(monotonicNanos() - started);
+}
+
+void Server::handlePass(Client* client, const Command& command) {
+    int fd = client->getFd();
+    if (client->isAuthenticated()) {
+        sendToClient(fd, ":server 462 :You may not reregister");
+        return;
+    }
+    
+    // The link password marks a peer server about to send SERVER
+    const std::string& given = command.getParams()[0];
+    if (!config.linkPassword.empty() && given == config.linkPassword) {
+        linkCandidates.insert(client);
+        if (given != password) return;
+    }
+    
+    if (given == password) {
+        client->setPassOk(true);
+        LOG_DEBUG << "Client " << fd << " password accepted";
+    } else {
+        sendToClient(fd, ":server 464 :Password incorrect");
+    }
+}
+
+void Server::handleUser(Client* client, const Command& command) {
+    int fd = client->getFd();
+    if (client->isAuthenticated()) {
+        sendToClient(fd, ":server 462 :You may not reregister");
+        return;
+    }
+    
+    client->setUsername(command.getParams()[0]);
+    client->setRealname(command.getParams()[3]);
+    LOG_DEBUG << "Client " << fd << " set username to " << command.getParams()[0];
+    
+    checkAuthentication(client);
+}
+
+void Server::handlePing(Client* client, const Command& command) {
+    std::string token = command.getParams().empty() ? "" : command.getParams()[0];
+    sendToClient(client->getFd(), "PONG server " + token);
+}
+
+void Server::handlePong(Client*, const Command&) {
+    // The reactor already counted the line as activity for the keepalive
+}
+
+void Server::handleNick(Client* client, const Command& command) {
+    int fd = client->getFd();
+    if (command.getParams().empty()) {
+        sendToClient(fd, ":server 431 :No nickname given");
+        return;
+    }
+    
+    // Changing only the case of one's own nickname is allowed
+    std::string nickname = command.getParams()[0];
+    Client* owner = getClientByNickname(nickname);
+    if (owner && owner != client) {
+        sendToClient(fd, ":server 433 " + nickname + " :Nickname is already in use");
+        return;
+    }
+    
+    if (!client->isAuthenticated()) {
+        setClientNickname(client, nickname);
+        LOG_INFO << "Client " << fd << " set nickname to " << nickname;
+        
+        checkAuthentication(client);
+        return;
+    }
+    
+    std::string nickMsg = relayLine(client, "NICK", "", nickname);
+    setClientNickname(client, nickname);
+    LOG_INFO << "Client " << fd << " changed nickname to " << nickname;
+    
+    broadcastToPeers(client, nickMsg, true);
+    propagate(nickMsg, NULL);
 }
 
 void Server::checkAuthentication(Client* client) {
@@ -289,26 +583,70 @@ void Server::checkAuthentication(Client* client) {
         client->setAuthenticated(true);
         sendToClient(client->getFd(), ":server 001 " + client->getNickname() + 
                    " :Welcome to the IRC server " + client->getNickname() + "!");
+        
+        // RPL_ISUPPORT; JOIN and PART lists are only bounded by the line length
+        std::ostringstream isupport;
+        isupport << ":server 005 " << client->getNickname() << " CHANTYPES=# TARGMAX=JOIN:,PART:,PRIVMSG:"
+                 << config.maxTargets << ",KICK:" << config.maxTargets << " :are supported by this server";
+        sendToClient(client->getFd(), isupport.str());
+        
+        propagate(introduction(client), NULL);
     }
 }
 
 void Server::handleJoin(Client* client, const Command& command) {
-    if (command.getParams().empty()) {
-        sendToClient(client->getFd(), ":server 461 JOIN :Not enough parameters");
+    const std::vector<std::string>& params = command.getParams();
+    
+    // "JOIN 0" leaves every channel
+    if (params[0] == "0") {
+        std::set<Channel*> joined = client->getChannels();
+        for (std::set<Channel*>::iterator it = joined.begin(); it != joined.end(); ++it)
+            partChannel(client, (*it)->getName(), "Leaving");
         return;
     }
     
-    std::string channelName = command.getParams()[0];
+    // Keys pair with channels by position; channels past the last key get none
+    std::vector<std::string> names, keys;
+    splitList(params[0], names);
+    if (params.size() > 1)
+        splitList(params[1], keys);
+    
+    for (size_t i = 0; i < names.size(); ++i) {
+        if (!names[i].empty())
+            joinChannel(client, names[i], i < keys.size() ? keys[i] : "");
+    }
+}
+
+void Server::joinChannel(Client* client, const std::string& name, const std::string& key) {
+    std::string channelName = name;
     if (channelName[0] != '#') channelName = "#" + channelName;
     
     Channel* channel = getChannel(channelName);
+    bool created = !channel;
     if (!channel) {
+        // A saved channel comes back with its settings; its key still
+        // applies, but nobody is left to invite anyone past +i
+        const ChannelState* saved = store.find(channelName);
+        if (saved && !saved->key.empty() && key != saved->key) {
+            sendToClient(client->getFd(), ":server 475 " + channelName + 
+                       " :Cannot join channel (+k) - wrong key");
+            return;
+        }
+        
         channel = createChannel(channelName, client);
-        std::cout << "Channel " << channelName << " created by " << client->getNickname() << std::endl;
+        if (saved) {
+            channel->setTopic(saved->topic);
+            channel->setPassword(saved->key);
+            channel->setUserLimit(saved->limit);
+            channel->setInviteOnly(saved->modes & STATE_INVITE_ONLY);
+            channel->setTopicRestricted(saved->modes & STATE_TOPIC_RESTRICTED);
+        }
+        LOG_INFO << "Channel " << channelName << " created by " << client->getNickname();
     } else {
+        if (channel->hasClient(client)) return;
+        
         // Check join restrictions
-        if (command.getParams().size() > 1 && channel->hasPassword() && 
-            command.getParams()[1] != channel->getPassword()) {
+        if (channel->hasPassword() && key != channel->getPassword()) {
             sendToClient(client->getFd(), ":server 475 " + channelName + 
                        " :Cannot join channel (+k) - wrong key");
             return;
@@ -321,7 +659,7 @@ void Server::handleJoin(Client* client, const Command& command) {
         }
         
         if (channel->hasUserLimit() && 
-            static_cast<int>(channel->getClients().size()) >= channel->getUserLimit()) {
+            static_cast<int>(channel->getMemberCount()) >= channel->getUserLimit()) {
             sendToClient(client->getFd(), ":server 471 " + channelName + 
                        " :Cannot join channel (+l) - channel is full");
             return;
@@ -332,39 +670,92 @@ void Server::handleJoin(Client* client, const Command& command) {
     channel->addClient(client);
     
     // Notify channel and send channel info
-    std::string joinMsg = ":" + client->getNickname() + "!" + client->getUsername() + 
-                        "@" + client->getIp() + " JOIN " + channelName;
+    std::string joinMsg = client->getPrefix() + " JOIN " + channelName;
     channel->broadcast(joinMsg, NULL);
+    announceJoin(channel, client, created);
     
     if (!channel->getTopic().empty()) {
         sendToClient(client->getFd(), ":server 332 " + client->getNickname() + " " + 
                    channelName + " :" + channel->getTopic());
     }
     
-    // Send user list
-    std::string names = ":server 353 " + client->getNickname() + " = " + channelName + " :";
-    std::vector<Client*> clients = channel->getClients();
-    for (size_t i = 0; i < clients.size(); ++i) {
-        if (channel->isOperator(clients[i])) names += "@";
-        names += clients[i]->getNickname() + " ";
-    }
+    sendNames(client, channel);
+}
+
+void Server::sendNames(Client* client, Channel* channel) {
+    const std::string& nick = client->getNickname();
+    const std::string& channelName = channel->getName();
+    
+    // ":server 353 <nick> = <channel> :<names>" must fit in one line
+    size_t overhead = strlen(":server 353 ") + std::max(nick.size(), NAMES_NICK_RESERVE) +
+                      strlen(" = ") + channelName.size() + strlen(" :");
+    size_t limit = LineBuffer::MAX_LINE - 2;
+    size_t width = (overhead + NAMES_NICK_RESERVE < limit) ? limit - overhead : NAMES_NICK_RESERVE;
     
-    sendToClient(client->getFd(), names);
-    sendToClient(client->getFd(), ":server 366 " + client->getNickname() + " " + 
-               channelName + " :End of NAMES list");
+    const std::vector<std::string>& chunks = channel->getNames(width);
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        std::string line;
+        line.reserve(overhead + chunks[i].size());
+        line += ":server 353 ";
+        line += nick;
+        line += " = ";
+        line += channelName;
+        line += " :";
+        line += chunks[i];
+        sendToClient(client->getFd(), line);
+    }
+    sendToClient(client->getFd(), ":server 366 " + nick + " " + channelName + " :End of NAMES list");
 }
 
-void Server::handlePrivmsg(Client* client, const Command& command) {
-    if (command.getParams().size() < 2) {
-        sendToClient(client->getFd(), ":server 461 PRIVMSG :Not enough parameters");
+void Server::handleNames(Client* client, const Command& command) {
+    // Without a channel list only the end marker is sent, listing every
+    // channel would flood the client on a busy server
+    if (command.getParams().empty()) {
+        sendToClient(client->getFd(), ":server 366 " + client->getNickname() + " * :End of NAMES list");
         return;
     }
     
-    std::string target = command.getParams()[0];
-    std::string message = command.getParams()[1];
-    std::string prefix = ":" + client->getNickname() + "!" + client->getUsername() + 
-                       "@" + client->getIp();
+    std::vector<std::string> names;
+    splitList(command.getParams()[0], names);
+    for (size_t i = 0; i < names.size(); ++i) {
+        if (names[i].empty()) continue;
+        
+        Channel* channel = getChannel(names[i]);
+        if (channel)
+            sendNames(client, channel);
+        else
+            sendToClient(client->getFd(), ":server 366 " + client->getNickname() + " " + names[i] +
+                       " :End of NAMES list");
+    }
+}
+
+bool Server::checkTargetCount(Client* client, const char* command, size_t count) {
+    if (count <= config.maxTargets) return true;
     
+    // ERR_TOOMANYTARGETS: nothing is delivered
+    sendToClient(client->getFd(), std::string(":server 407 ") + client->getNickname() + " " +
+               command + " :Too many targets. No message delivered");
+    return false;
+}
+
+void Server::handlePrivmsg(Client* client, const Command& command) {
+    std::vector<std::string> targets;
+    splitList(command.getParams()[0], targets);
+    if (!checkTargetCount(client, "PRIVMSG", targets.size())) return;
+    
+    // A target listed twice only gets the message once. Duplicates are
+    // judged the way the target is looked up: channel names as written,
+    // nicknames case-folded
+    std::set<std::string> seen;
+    for (size_t i = 0; i < targets.size(); ++i) {
+        if (targets[i].empty()) continue;
+        std::string key = (targets[i][0] == '#') ? targets[i] : ircCaseFold(targets[i]);
+        if (seen.insert(key).second)
+            sendPrivmsg(client, targets[i], command.getParams()[1]);
+    }
+}
+
+void Server::sendPrivmsg(Client* client, const std::string& target, const std::string& text) {
     if (target[0] == '#') {
         // Channel message
         Channel* channel = getChannel(target);
@@ -378,7 +769,9 @@ void Server::handlePrivmsg(Client* client, const Command& command) {
             return;
         }
         
-        channel->broadcast(prefix + " PRIVMSG " + target + " :" + message, client);
+        std::string line = relayLine(client, "PRIVMSG", target, text);
+        channel->broadcast(line, client);
+        forwardToChannel(channel, line, NULL);
     } else {
         // Private message
         Client* targetClient = getClientByNickname(target);
@@ -387,20 +780,35 @@ void Server::handlePrivmsg(Client* client, const Command& command) {
             return;
         }
         
-        sendToClient(targetClient->getFd(), prefix + " PRIVMSG " + target + " :" + message);
+        // A remote user's transport forwards it along their route
+        targetClient->queueMessage(relayLine(client, "PRIVMSG", target, text));
     }
 }
 
 void Server::handleKick(Client* client, const Command& command) {
-    if (command.getParams().size() < 2) {
+    const std::vector<std::string>& params = command.getParams();
+    std::string reason = params.size() > 2 ? params[2] : "No reason given";
+    
+    // Either one channel and several users, or channels and users paired up
+    std::vector<std::string> channelNames, nicks;
+    splitList(params[0], channelNames);
+    splitList(params[1], nicks);
+    if (!checkTargetCount(client, "KICK", nicks.size())) return;
+    
+    if (channelNames.size() != 1 && channelNames.size() != nicks.size()) {
         sendToClient(client->getFd(), ":server 461 KICK :Not enough parameters");
         return;
     }
     
-    std::string channelName = command.getParams()[0];
-    std::string targetNick = command.getParams()[1];
-    std::string reason = command.getParams().size() > 2 ? command.getParams()[2] : "No reason given";
-    
+    for (size_t i = 0; i < nicks.size(); ++i) {
+        const std::string& channelName = channelNames[channelNames.size() == 1 ? 0 : i];
+        if (!channelName.empty() && !nicks[i].empty())
+            kickMember(client, channelName, nicks[i], reason);
+    }
+}
+
+void Server::kickMember(Client* client, const std::string& channelName, const std::string& targetNick,
+                        const std::string& reason) {
     Channel* channel = getChannel(channelName);
     Client* targetClient = getClientByNickname(targetNick);
     
@@ -418,21 +826,27 @@ void Server::handleKick(Client* client, const Command& command) {
     }
     
     // Broadcast kick and remove user
-    std::string kickMsg = ":" + client->getNickname() + "!" + client->getUsername() + "@" + 
-                        client->getIp() + " KICK " + channelName + " " + targetNick + " :" + reason;
-    channel->broadcast(kickMsg, NULL);
+    std::string kickMsg = relayLine(client, "KICK", channelName + " " + targetNick, reason);
+    channelEvent(channel, kickMsg, NULL);
     channel->removeClient(targetClient);
+    
+    // Operators may kick themselves out of the channel
+    if (channel->getMemberCount() == 0)
+        removeChannel(channelName);
 }
 
 void Server::handlePart(Client* client, const Command& command) {
-    if (command.getParams().empty()) {
-        sendToClient(client->getFd(), ":server 461 PART :Not enough parameters");
-        return;
-    }
-    
-    std::string channelName = command.getParams()[0];
     std::string reason = command.getParams().size() > 1 ? command.getParams()[1] : "Leaving";
     
+    std::vector<std::string> names;
+    splitList(command.getParams()[0], names);
+    for (size_t i = 0; i < names.size(); ++i) {
+        if (!names[i].empty())
+            partChannel(client, names[i], reason);
+    }
+}
+
+void Server::partChannel(Client* client, const std::string& channelName, const std::string& reason) {
     Channel* channel = getChannel(channelName);
     if (!channel || !channel->hasClient(client)) {
         if (!channel)
@@ -443,26 +857,21 @@ void Server::handlePart(Client* client, const Command& command) {
     }
     
     // Broadcast part and remove user
-    std::string partMsg = ":" + client->getNickname() + "!" + client->getUsername() + "@" + 
-                        client->getIp() + " PART " + channelName + " :" + reason;
-    channel->broadcast(partMsg, NULL);
+    std::string partMsg = relayLine(client, "PART", channelName, reason);
+    channelEvent(channel, partMsg, NULL);
     channel->removeClient(client);
     
     // Remove empty channel
-    if (channel->getClients().empty())
+    if (channel->getMemberCount() == 0)
         removeChannel(channelName);
 }
 
 void Server::handleTopic(Client* client, const Command& command) {
-    if (command.getParams().empty()) {
-        sendToClient(client->getFd(), ":server 461 TOPIC :Not enough parameters");
-        return;
-    }
-    
     std::string channelName = command.getParams()[0];
     Channel* channel = getChannel(channelName);
     
-    if (!channel || !channel->hasClient(client)) {
+    const Member* member = channel ? channel->findMember(client) : NULL;
+    if (!member) {
         if (!channel)
             sendToClient(client->getFd(), ":server 403 " + channelName + " :No such channel");
         else
@@ -480,26 +889,21 @@ void Server::handleTopic(Client* client, const Command& command) {
                        channelName + " :" + channel->getTopic());
     } else {
         // Set topic
-        if (channel->isTopicRestricted() && !channel->isOperator(client)) {
+        if (channel->isTopicRestricted() && !(member->flags & MEMBER_OP)) {
             sendToClient(client->getFd(), ":server 482 " + channelName + " :You're not channel operator");
             return;
         }
         
-        std::string newTopic = command.getParams()[1];
+        const std::string& newTopic = command.getParams()[1];
         channel->setTopic(newTopic);
+        saveChannelState(channel);
         
-        std::string topicMsg = ":" + client->getNickname() + "!" + client->getUsername() + "@" + 
-                             client->getIp() + " TOPIC " + channelName + " :" + newTopic;
-        channel->broadcast(topicMsg, NULL);
+        std::string topicMsg = relayLine(client, "TOPIC", channelName, newTopic);
+        channelEvent(channel, topicMsg, NULL);
     }
 }
 
 void Server::handleMode(Client* client, const Command& command) {
-    if (command.getParams().empty()) {
-        sendToClient(client->getFd(), ":server 461 MODE :Not enough parameters");
-        return;
-    }
-    
     std::string target = command.getParams()[0];
     
     if (target[0] != '#') return; // Only handle channel modes
@@ -529,8 +933,9 @@ void Server::handleMode(Client* client, const Command& command) {
     
     // Process modes
     std::string modeStr = command.getParams()[1];
-    std::string prefix = ":" + client->getNickname() + "!" + client->getUsername() + "@" + client->getIp();
+    const std::string& prefix = client->getPrefix();
     bool add = true;
+    bool settingsChanged = false;
     
     // C++98 compliant way to iterate through string
     for (size_t i = 0; i < modeStr.length(); ++i) {
@@ -539,26 +944,30 @@ void Server::handleMode(Client* client, const Command& command) {
         else if (c == '-') add = false;
         else if (c == 'i') {
             channel->setInviteOnly(add);
-            channel->broadcast(prefix + " MODE " + target + " " + (add ? "+" : "-") + "i", NULL);
+            settingsChanged = true;
+            channelEvent(channel, prefix + " MODE " + target + " " + (add ? "+" : "-") + "i", NULL);
         } else if (c == 't') {
             channel->setTopicRestricted(add);
-            channel->broadcast(prefix + " MODE " + target + " " + (add ? "+" : "-") + "t", NULL);
+            settingsChanged = true;
+            channelEvent(channel, prefix + " MODE " + target + " " + (add ? "+" : "-") + "t", NULL);
         } else if (c == 'k' && ((add && command.getParams().size() > 2) || !add)) {
+            settingsChanged = true;
             if (add) {
                 channel->setPassword(command.getParams()[2]);
-                channel->broadcast(prefix + " MODE " + target + " +k " + command.getParams()[2], NULL);
+                channelEvent(channel, prefix + " MODE " + target + " +k " + command.getParams()[2], NULL);
             } else {
                 channel->setPassword("");
-                channel->broadcast(prefix + " MODE " + target + " -k", NULL);
+                channelEvent(channel, prefix + " MODE " + target + " -k", NULL);
             }
         } else if (c == 'l' && ((add && command.getParams().size() > 2) || !add)) {
+            settingsChanged = true;
             if (add) {
                 int limit = std::atoi(command.getParams()[2].c_str());
                 channel->setUserLimit(limit);
-                channel->broadcast(prefix + " MODE " + target + " +l " + command.getParams()[2], NULL);
+                channelEvent(channel, prefix + " MODE " + target + " +l " + command.getParams()[2], NULL);
             } else {
                 channel->setUserLimit(0);
-                channel->broadcast(prefix + " MODE " + target + " -l", NULL);
+                channelEvent(channel, prefix + " MODE " + target + " -l", NULL);
             }
         } else if (c == 'o' && command.getParams().size() > 2) {
             std::string targetNick = command.getParams()[2];
@@ -573,36 +982,59 @@ void Server::handleMode(Client* client, const Command& command) {
             if (add) channel->addOperator(targetClient);
             else channel->removeOperator(targetClient);
             
-            channel->broadcast(prefix + " MODE " + target + " " + (add ? "+" : "-") + 
-                             "o " + targetNick, NULL);
+            channelEvent(channel, prefix + " MODE " + target + " " + (add ? "+" : "-") + 
+                         "o " + targetNick, NULL);
+        } else if (c == 'v' && command.getParams().size() > 2) {
+            std::string targetNick = command.getParams()[2];
+            Client* targetClient = getClientByNickname(targetNick);
+            
+            if (!targetClient || !channel->hasClient(targetClient)) {
+                sendToClient(client->getFd(), ":server 441 " + targetNick + " " + 
+                           target + " :They aren't on that channel");
+                continue;
+            }
+            
+            channel->setVoice(targetClient, add);
+            channelEvent(channel, prefix + " MODE " + target + " " + (add ? "+" : "-") + 
+                         "v " + targetNick, NULL);
         }
     }
+    
+    if (settingsChanged)
+        saveChannelState(channel);
+}
+
+void Server::saveChannelState(Channel* channel) {
+    ChannelState state;
+    state.topic = channel->getTopic();
+    state.key = channel->getPassword();
+    state.limit = channel->getUserLimit();
+    state.modes = (channel->isInviteOnly() ? STATE_INVITE_ONLY : 0) |
+                  (channel->isTopicRestricted() ? STATE_TOPIC_RESTRICTED : 0);
+    store.save(channel->getName(), state);
 }
 
 void Server::handleInvite(Client* client, const Command& command) {
-    if (command.getParams().size() < 2) {
-        sendToClient(client->getFd(), ":server 461 INVITE :Not enough parameters");
-        return;
-    }
-    
     std::string targetNick = command.getParams()[0];
     std::string channelName = command.getParams()[1];
     
     Client* targetClient = getClientByNickname(targetNick);
     Channel* channel = getChannel(channelName);
     
+    const Member* member = channel ? channel->findMember(client) : NULL;
+    
     // Validation checks
-    if (!targetClient || !channel || !channel->hasClient(client) || 
-        (channel->isInviteOnly() && !channel->isOperator(client)) || 
+    if (!targetClient || !member || 
+        (channel->isInviteOnly() && !(member->flags & MEMBER_OP)) || 
         channel->hasClient(targetClient)) {
         
         if (!targetClient)
             sendToClient(client->getFd(), ":server 401 " + targetNick + " :No such nick/channel");
         else if (!channel)
             sendToClient(client->getFd(), ":server 403 " + channelName + " :No such channel");
-        else if (!channel->hasClient(client))
+        else if (!member)
             sendToClient(client->getFd(), ":server 442 " + channelName + " :You're not on that channel");
-        else if (channel->isInviteOnly() && !channel->isOperator(client))
+        else if (channel->isInviteOnly() && !(member->flags & MEMBER_OP))
             sendToClient(client->getFd(), ":server 482 " + channelName + " :You're not channel operator");
         else
             sendToClient(client->getFd(), ":server 443 " + targetNick + " " + channelName + 
@@ -610,24 +1042,443 @@ void Server::handleInvite(Client* client, const Command& command) {
         return;
     }
     
-    // Add to invited list and send notifications
-    channel->addInvited(targetClient);
+    // Add to invited list and send notifications; a remote user joins on
+    // its own server, which records the invite when the INVITE arrives
+    if (!targetClient->isRemote())
+        channel->addInvited(targetClient);
     sendToClient(client->getFd(), ":server 341 " + client->getNickname() + " " + targetNick + " " + channelName);
-    sendToClient(targetClient->getFd(), ":" + client->getNickname() + "!" + client->getUsername() + 
-               "@" + client->getIp() + " INVITE " + targetNick + " :" + channelName);
+    targetClient->queueMessage(relayLine(client, "INVITE", targetNick, channelName));
 }
 
 void Server::handleQuit(Client* client, const Command& command) {
     std::string reason = command.getParams().empty() ? "Quit" : command.getParams()[0];
-    std::string quitMsg = ":" + client->getNickname() + "!" + client->getUsername() + 
-                        "@" + client->getIp() + " QUIT :" + reason;
+    countDisconnect("Quit");
+    disconnectClient(client, reason);
+}
+
+void Server::handleOper(Client* client, const Command& command) {
+    int fd = client->getFd();
+    const std::string& nick = client->getNickname();
+    
+    // A single shared operator password; the name parameter is not checked
+    if (config.operPassword.empty()) {
+        sendToClient(fd, ":server 491 " + nick + " :No O-lines for your host");
+        return;
+    }
+    if (command.getParams()[1] != config.operPassword) {
+        sendToClient(fd, ":server 464 " + nick + " :Password incorrect");
+        return;
+    }
+    
+    client->setOper(true);
+    sendToClient(fd, ":server 381 " + nick + " :You are now an IRC operator");
+    LOG_INFO << "Client " << fd << " (" << nick << ") is now an operator";
+}
+
+void Server::handleUpgrade(Client* client, const Command&) {
+    int fd = client->getFd();
+    const std::string& nick = client->getNickname();
+    
+    if (!client->isOper()) {
+        sendToClient(fd, ":server 481 " + nick + " :Permission Denied- You're not an IRC operator");
+        return;
+    }
+    if (reactors.size() != 1) {
+        sendToClient(fd, ":server NOTICE " + nick + " :UPGRADE needs a single reactor thread");
+        return;
+    }
+    if (!links.empty()) {
+        sendToClient(fd, ":server NOTICE " + nick + " :UPGRADE is not available while linked to other servers");
+        return;
+    }
+    if (tlsContext) {
+        sendToClient(fd, ":server NOTICE " + nick + " :UPGRADE is not available with a TLS port");
+        return;
+    }
+    if (std::string(reactors[0]->getBackendName()) == "io_uring") {
+        sendToClient(fd, ":server NOTICE " + nick + " :UPGRADE is not available with the io_uring backend");
+        return;
+    }
+    
+    LOG_INFO << "Upgrade requested by " << nick;
+    sendToClient(fd, ":server NOTICE " + nick + " :Upgrading server");
+    requestUpgrade();
+}
+
+void Server::handleStats(Client* client, const Command& command) {
+    int fd = client->getFd();
+    const std::string& nick = client->getNickname();
+    
+    if (!client->isOper()) {
+        sendToClient(fd, ":server 481 " + nick + " :Permission Denied- You're not an IRC operator");
+        return;
+    }
+    
+    std::string query = command.getParams().empty() ? "*" : command.getParams()[0];
+    std::ostringstream reply;
+    
+    if (query == "m") {
+        // RPL_STATSCOMMANDS: <command> <count>
+        for (size_t i = 0; i < CMD_NONE; ++i) {
+            if (!commandStats[i].calls) continue;
+            reply.str("");
+            reply << ":server 212 " << nick << " " << commandTable[i].name << " " << commandStats[i].calls;
+            sendToClient(fd, reply.str());
+        }
+    } else if (query == "u") {
+        long up = static_cast<long>(time(NULL) - startTime);
+        char uptime[64];
+        snprintf(uptime, sizeof(uptime), "Server Up %ld days %ld:%02ld:%02ld",
+                 up / 86400, up / 3600 % 24, up / 60 % 60, up % 60);
+        sendToClient(fd, ":server 242 " + nick + " :" + uptime);
+    } else {
+        std::vector<std::string> lines;
+        collectMetrics(lines);
+        for (size_t i = 0; i < lines.size(); ++i)
+            sendToClient(fd, ":server 249 " + nick + " :" + lines[i]);
+    }
+    sendToClient(fd, ":server 219 " + nick + " " + query + " :End of STATS report");
+}
+
+void Server::countDisconnect(const std::string& reason) {
+    ++disconnects[reason];
+}
+
+// One metric per line in the Prometheus text format, for STATS and the
+// stats socket alike
+void Server::collectMetrics(std::vector<std::string>& lines) const {
+    ReactorStats total;
+    for (size_t i = 0; i < reactors.size(); ++i) {
+        const ReactorStats& stats = reactors[i]->getStats();
+        total.accepted += statRead(stats.accepted);
+        total.bytesIn += statRead(stats.bytesIn);
+        total.linesIn += statRead(stats.linesIn);
+        total.bytesOut += statRead(stats.bytesOut);
+        total.messagesOut += statRead(stats.messagesOut);
+        total.sendqBytes += statRead(stats.sendqBytes);
+        total.sendqPeak = std::max(total.sendqPeak, statRead(stats.sendqPeak));
+        total.throttled += statRead(stats.throttled);
+        total.congested += statRead(stats.congested);
+        total.tlsHandshakes += statRead(stats.tlsHandshakes);
+        total.tlsResumed += statRead(stats.tlsResumed);
+        total.tlsKernelSend += statRead(stats.tlsKernelSend);
+    }
+    
+    std::ostringstream line;
+    line << "ircserv_uptime_seconds " << (time(NULL) - startTime);
+    lines.push_back(line.str());
     
-    // Notify all channels this client is in - using C++98 iterator
-    std::map<std::string, Channel*>::iterator it;
-    for (it = channels.begin(); it != channels.end(); ++it) {
-        if (it->second->hasClient(client))
-            it->second->broadcast(quitMsg, client);
+    const char* names[] = {
+        "ircserv_clients", "ircserv_channels", "ircserv_connections_accepted_total",
+        "ircserv_bytes_in_total", "ircserv_messages_in_total", "ircserv_bytes_out_total",
+        "ircserv_messages_out_total", "ircserv_sendq_bytes", "ircserv_sendq_peak_bytes",
+        "ircserv_input_throttled_total", "ircserv_saved_channels", "ircserv_server_links",
+        "ircserv_remote_users", "ircserv_tls_handshakes_total", "ircserv_tls_resumed_total",
+        "ircserv_tls_ktls_send_total", "ircserv_input_congested_total"
+    };
+    size_t values[] = {
+        clients.size(), channels.size(), total.accepted,
+        total.bytesIn, total.linesIn, total.bytesOut,
+        total.messagesOut, total.sendqBytes, total.sendqPeak,
+        total.throttled, store.size(), links.size(),
+        remoteUsers.size(), total.tlsHandshakes, total.tlsResumed,
+        total.tlsKernelSend, total.congested
+    };
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+        line.str("");
+        line << names[i] << " " << values[i];
+        lines.push_back(line.str());
     }
     
-    removeClient(client->getFd());
-}
\ No newline at end of file
+    const double quantiles[] = {50, 90, 99};
+    for (size_t i = 0; i <= CMD_NONE; ++i) {
+        const CommandStats& stats = commandStats[i];
+        if (!stats.calls) continue;
+        
+        std::string name = (i == CMD_NONE) ? "unknown" : commandTable[i].name;
+        line.str("");
+        line << "ircserv_command_calls_total{command=\"" << name << "\"} " << stats.calls;
+        lines.push_back(line.str());
+        
+        if (!stats.latency.getCount()) continue;
+        for (size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); ++q) {
+            line.str("");
+            line << "ircserv_command_latency_ns{command=\"" << name << "\",quantile=\""
+                 << quantiles[q] / 100 << "\"} " << stats.latency.getPercentile(quantiles[q]);
+            lines.push_back(line.str());
+        }
+        line.str("");
+        line << "ircserv_command_latency_ns_max{command=\"" << name << "\"} " << stats.latency.getMax();
+        lines.push_back(line.str());
+    }
+    
+    std::map<std::string, size_t>::const_iterator it;
+    for (it = disconnects.begin(); it != disconnects.end(); ++it) {
+        line.str("");
+        line << "ircserv_disconnects_total{reason=\"" << it->first << "\"} " << it->second;
+        lines.push_back(line.str());
+    }
+}
+
+void Server::openStatsSocket() {
+    if (config.statsSocket.empty()) return;
+    
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (config.statsSocket.size() >= sizeof(addr.sun_path))
+        throw std::runtime_error("Stats socket path too long");
+    strcpy(addr.sun_path, config.statsSocket.c_str());
+    
+    statsFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (statsFd == -1)
+        throw std::runtime_error("Failed to create stats socket");
+    
+    // A stale socket file from a previous run would make bind() fail
+    unlink(addr.sun_path);
+    if (bind(statsFd, (struct sockaddr*)&addr, sizeof(addr)) == -1 || listen(statsFd, 16) == -1) {
+        close(statsFd);
+        statsFd = -1;
+        throw std::runtime_error("Failed to bind stats socket");
+    }
+    LOG_INFO << "Metrics available on " << config.statsSocket;
+}
+
+void Server::serveStats() {
+    // Each connection gets one dump and is closed; drain the whole backlog
+    for (;;) {
+        int fd = accept(statsFd, NULL, NULL);
+        if (fd == -1) return;
+        
+        std::vector<std::string> lines;
+        collectMetrics(lines);
+        std::string dump;
+        for (size_t i = 0; i < lines.size(); ++i)
+            dump += lines[i] + "\n";
+        
+        // The dump fits in the socket buffer; a reader that is not there is skipped
+        send(fd, dump.data(), dump.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+        close(fd);
+    }
+}
+
+void Server::onWatchedReadable(int fd) {
+    if (fd == statsFd)
+        serveStats();
+    else if (fd == linkTimerFd)
+        connectLinks();
+}
+
+void Server::noticeOpers(const std::string& text) {
+    for (int fd = 0; fd < clients.limit(); ++fd) {
+        Client* client = clients.find(fd);
+        if (client && client->isOper())
+            client->queueMessage(":server NOTICE " + client->getNickname() + " :" + text);
+    }
+}
+
+// Clients, channels and unprocessed input/output go into the state blob;
+// the listening socket and the client sockets, in the same order, into `fds`
+void Server::serializeState(StateWriter& writer, std::vector<int>& fds) {
+    writer.putString(STATE_MAGIC);
+    fds.push_back(reactors[0]->getListenFd());
+    
+    std::vector<Client*> handed;
+    std::tr1::unordered_map<Client*, size_t> indexOf;
+    for (int fd = 0; fd < clients.limit(); ++fd) {
+        Client* client = clients.find(fd);
+        if (client && !client->isDetached() && !client->isClosing()) {
+            indexOf[client] = handed.size();
+            handed.push_back(client);
+        }
+    }
+    
+    writer.putInt(handed.size());
+    for (size_t i = 0; i < handed.size(); ++i) {
+        Client* client = handed[i];
+        StringRef input = client->getInput().buffered();
+        std::string output;
+        client->getPendingOutput(output);
+        
+        writer.putString(client->getIp());
+        writer.putString(client->getNickname());
+        writer.putString(client->getUsername());
+        writer.putString(client->getRealname());
+        writer.putInt((client->isAuthenticated() ? 1 : 0) | (client->isPassOk() ? 2 : 0) |
+                      (client->isOper() ? 4 : 0));
+        writer.putString(input.size ? input.str() : std::string());
+        writer.putString(output);
+        fds.push_back(client->getFd());
+    }
+    
+    writer.putInt(channels.size());
+    for (std::map<std::string, Channel*>::iterator it = channels.begin(); it != channels.end(); ++it) {
+        Channel* channel = it->second;
+        writer.putString(channel->getName());
+        writer.putString(channel->getTopic());
+        writer.putString(channel->getPassword());
+        writer.putInt((channel->isInviteOnly() ? 1 : 0) | (channel->isTopicRestricted() ? 2 : 0));
+        writer.putInt(channel->getUserLimit());
+        
+        // Members and invitees that are not handed over (closing, detached)
+        // are left out rather than mapped onto someone else's index
+        std::vector<size_t> memberIndex;
+        std::vector<int> memberFlags;
+        const std::vector<Member>& members = channel->getMembers();
+        for (size_t i = 0; i < members.size(); ++i) {
+            std::tr1::unordered_map<Client*, size_t>::iterator found = indexOf.find(members[i].client);
+            if (found != indexOf.end()) {
+                memberIndex.push_back(found->second);
+                memberFlags.push_back(members[i].flags);
+            }
+        }
+        writer.putInt(memberIndex.size());
+        for (size_t i = 0; i < memberIndex.size(); ++i) {
+            writer.putInt(memberIndex[i]);
+            writer.putInt(memberFlags[i]);
+        }
+        
+        std::vector<size_t> invitedIndex;
+        const std::set<Client*>& invited = channel->getInvited();
+        for (std::set<Client*>::const_iterator inv = invited.begin(); inv != invited.end(); ++inv) {
+            std::tr1::unordered_map<Client*, size_t>::iterator found = indexOf.find(*inv);
+            if (found != indexOf.end())
+                invitedIndex.push_back(found->second);
+        }
+        writer.putInt(invitedIndex.size());
+        for (size_t i = 0; i < invitedIndex.size(); ++i)
+            writer.putInt(invitedIndex[i]);
+    }
+}
+
+bool Server::handOver() {
+    // Remote users and link state are not part of the handoff
+    if (!links.empty()) {
+        LOG_ERROR << "Upgrade refused: linked to other servers";
+        return false;
+    }
+    // TLS sessions live in this process's OpenSSL state
+    if (tlsContext) {
+        LOG_ERROR << "Upgrade refused: TLS connections cannot be handed over";
+        return false;
+    }
+    // Nor can requests the kernel has in flight on io_uring
+    if (std::string(reactors[0]->getBackendName()) == "io_uring") {
+        LOG_ERROR << "Upgrade refused: not supported with the io_uring backend";
+        return false;
+    }
+    LOG_INFO << "Starting upgrade: handing " << clients.size() << " clients to a new process";
+    
+    // The successor loads the state file as soon as it starts
+    store.flush();
+    
+    pid_t pid;
+    int sock = spawnSuccessor(config.arguments, pid);
+    if (sock == -1) {
+        LOG_ERROR << "Upgrade failed: cannot start " << config.arguments[0] << ": " << strerror(errno);
+        return false;
+    }
+    
+    StateWriter writer;
+    std::vector<int> fds;
+    serializeState(writer, fds);
+    
+    // Until the successor answers, this process still owns every client
+    bool ok = sendState(sock, writer.data(), fds) && waitForSuccessor(sock, UPGRADE_TIMEOUT_MS);
+    close(sock);
+    if (!ok) {
+        LOG_ERROR << "Upgrade failed: the new process did not take over";
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        return false;
+    }
+    
+    LOG_INFO << "Upgrade complete: process " << static_cast<long>(pid) << " took over";
+    return true;
+}
+
+void Server::restoreState(int sock) {
+    std::string state;
+    std::vector<int> fds;
+    if (!receiveState(sock, state, fds) || fds.empty())
+        throw std::runtime_error("Failed to receive upgrade state");
+    
+    StateReader reader(state);
+    if (reader.getString() != STATE_MAGIC)
+        throw std::runtime_error("Upgrade state has an unknown format");
+    
+    reactors.push_back(new Reactor(config, fds[0], this, false));
+    
+    std::vector<Client*> restored;
+    size_t clientCount = reader.getInt();
+    for (size_t i = 0; i < clientCount && reader.ok(); ++i) {
+        if (i + 1 >= fds.size())
+            throw std::runtime_error("Upgrade state is missing client sockets");
+        
+        Client* client = new Client(fds[i + 1], reader.getString(), reactors[0], config.sendQueueLimit);
+        std::string nickname = reader.getString();
+        client->setUsername(reader.getString());
+        client->setRealname(reader.getString());
+        unsigned long long flags = reader.getInt();
+        client->setAuthenticated(flags & 1);
+        client->setPassOk(flags & 2);
+        client->setOper(flags & 4);
+        setClientNickname(client, nickname);
+        
+        std::string input = reader.getString();
+        std::string output = reader.getString();
+        clients.insert(client->getFd(), client);
+        reactors[0]->adopt(client, input);
+        if (!output.empty())
+            client->queueMessage(output);
+        restored.push_back(client);
+    }
+    
+    size_t channelCount = reader.getInt();
+    for (size_t i = 0; i < channelCount && reader.ok(); ++i) {
+        std::string name = reader.getString();
+        std::string topic = reader.getString();
+        std::string key = reader.getString();
+        unsigned long long modes = reader.getInt();
+        int userLimit = static_cast<int>(reader.getInt());
+        
+        // The first member creates the channel; every status is then set as it was
+        Channel* channel = NULL;
+        size_t memberCount = reader.getInt();
+        for (size_t m = 0; m < memberCount && reader.ok(); ++m) {
+            size_t index = reader.getInt();
+            int memberFlags = static_cast<int>(reader.getInt());
+            if (index >= restored.size()) continue;
+            
+            Client* member = restored[index];
+            if (!channel)
+                channel = createChannel(name, member);
+            channel->addClient(member);
+            if (memberFlags & MEMBER_OP)
+                channel->addOperator(member);
+            else
+                channel->removeOperator(member);
+            channel->setVoice(member, memberFlags & MEMBER_VOICE);
+        }
+        
+        size_t invitedCount = reader.getInt();
+        for (size_t v = 0; v < invitedCount && reader.ok(); ++v) {
+            size_t index = reader.getInt();
+            if (channel && index < restored.size())
+                channel->addInvited(restored[index]);
+        }
+        if (!channel) continue;
+        
+        channel->setTopic(topic);
+        channel->setPassword(key);
+        channel->setInviteOnly(modes & 1);
+        channel->setTopicRestricted(modes & 2);
+        channel->setUserLimit(userLimit);
+    }
+    
+    if (!reader.ok())
+        throw std::runtime_error("Upgrade state is truncated");
+    
+    confirmHandoff(sock);
+    LOG_INFO << "Upgrade: resumed " << restored.size() << " clients and " << channels.size() << " channels";
+}
@@ -0,0 +1,665 @@
+#include "../include/Server.hpp"
+#include "../include/Command.hpp"
+#include "../include/Logger.hpp"
+#include "../include/utils.hpp"
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <climits>
+#include <sstream>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <arpa/inet.h>
+
+// Server links speak the client protocol with full prefixes, plus:
+//   PASS <password>, SERVER <name>              handshake, sent by both sides
+//   :<server> SERVER <name>                     a server further down the link
+//   :<server> SQUIT <name> :<reason>            ... that went away
+//   NICK <nick> <user> <host> :<realname>       a user introduction
+//   :<server> NJOIN <channel> :[@][+]<nick>,...  members joining, with status
+//   :<server> CHANSET <channel> <ts> +<modes> <key|*> <limit> :<topic>
+//   :<server> KILL <nick> :<reason>
+// Servers form a tree and every one of them keeps the whole user and
+// channel state, so state changes are flooded to all links. PRIVMSG and
+// INVITE only travel toward the links their recipients are behind.
+
+// Seconds between attempts to dial configured peers that are not linked
+static const int LINK_RETRY_SECONDS = 5;
+
+// Remote users' output goes to the server link they are reached through
+class LinkTransport : public Transport {
+public:
+    void deliver(Client* client, Payload* payload) { client->getRoute()->queueMessage(payload); }
+    void disconnect(Client*, const std::string&) {}
+    void scheduleFlush(Client*) {}
+};
+
+static LinkTransport linkTransport;
+
+// Names need a dot so a prefix can never be mistaken for a nickname
+static bool isValidServerName(const std::string& name) {
+    return name.size() <= 63 && name.find('.') != std::string::npos &&
+           name.find_first_of(" :,!@*") == std::string::npos;
+}
+
+// The prefix up to '!': a nickname or a server name
+static std::string prefixSource(const StringRef& prefix) {
+    size_t end = 0;
+    while (end < prefix.size && prefix.data[end] != '!') ++end;
+    return std::string(prefix.data, end);
+}
+
+void Server::openLinkTimer() {
+    if (config.connectTo.empty()) return;
+    
+    linkTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (linkTimerFd == -1)
+        throw std::runtime_error("Failed to create link timer");
+    
+    // The first round dials as soon as the loop runs
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_nsec = 1;
+    spec.it_interval.tv_sec = LINK_RETRY_SECONDS;
+    timerfd_settime(linkTimerFd, 0, &spec, NULL);
+}
+
+void Server::connectLinks() {
+    unsigned long long expirations;
+    if (read(linkTimerFd, &expirations, sizeof(expirations)) != sizeof(expirations))
+        return;
+    
+    for (size_t i = 0; i < config.connectTo.size(); ++i) {
+        bool linked = false;
+        for (std::map<Client*, PeerLink>::iterator it = links.begin(); it != links.end(); ++it) {
+            if (it->second.target == config.connectTo[i])
+                linked = true;
+        }
+        if (!linked)
+            connectLink(config.connectTo[i]);
+    }
+}
+
+void Server::connectLink(const std::string& target) {
+    size_t colon = target.rfind(':');
+    std::string host = target.substr(0, colon);
+    
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(std::atoi(target.c_str() + colon + 1));
+    if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1)
+        return;
+    
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        LOG_ERROR << "Cannot link to " << target << ": " << strerror(errno);
+        return;
+    }
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1 && errno != EINPROGRESS) {
+        LOG_INFO << "Cannot link to " << target << ": " << strerror(errno);
+        close(fd);
+        return;
+    }
+    
+    // The reactor takes the socket like an accepted one; the link
+    // registers once the peer's PASS and SERVER arrive
+    Client* link = new Client(fd, host, reactors[0], config.sendQueueLimit);
+    link->setServerLink(true);
+    link->setAuthenticated(true);
+    clients.insert(fd, link);
+    links[link].target = target;
+    reactors[0]->attach(link);
+    
+    link->queueMessage("PASS " + config.linkPassword);
+    link->queueMessage("SERVER " + serverName);
+    LOG_INFO << "Linking to " << target;
+}
+
+void Server::handleServer(Client* client, const Command& command) {
+    if (client->isAuthenticated()) {
+        sendToClient(client->getFd(), ":server 462 :You may not reregister");
+        return;
+    }
+    if (!linkCandidates.count(client)) {
+        countDisconnect("Bad link password");
+        disconnectClient(client, "Bad link password");
+        return;
+    }
+    
+    const std::string& name = command.getParams()[0];
+    if (!isValidServerName(name) || name == serverName || servers.count(name)) {
+        countDisconnect("Server already linked");
+        disconnectClient(client, "Server " + name + " already linked");
+        return;
+    }
+    
+    // The connection becomes a link; a nickname it may have sent goes away
+    linkCandidates.erase(client);
+    setClientNickname(client, "");
+    client->setServerLink(true);
+    client->setAuthenticated(true);
+    links[client].passOk = true;
+    
+    client->queueMessage("PASS " + config.linkPassword);
+    client->queueMessage("SERVER " + serverName);
+    registerLink(client, name);
+}
+
+void Server::registerLink(Client* link, const std::string& name) {
+    links[link].name = name;
+    servers[name] = link;
+    LOG_INFO << "Linked with server " << name << " (" << link->getIp() << ")";
+    noticeOpers("Link with " + name + " established");
+    
+    propagate(":" + serverName + " SERVER " + name, link);
+    sendBurst(link);
+}
+
+// Servers, then users, then channels, so every line only names what the
+// peer already knows. Nothing is sent back about what lies behind the peer.
+void Server::sendBurst(Client* link) {
+    for (std::map<std::string, Client*>::iterator it = servers.begin(); it != servers.end(); ++it) {
+        if (it->second != link)
+            link->queueMessage(":" + serverName + " SERVER " + it->first);
+    }
+    
+    std::tr1::unordered_map<std::string, Client*>::iterator user;
+    for (user = nicknames.begin(); user != nicknames.end(); ++user) {
+        if (user->second->isAuthenticated() && user->second->getRoute() != link)
+            link->queueMessage(introduction(user->second));
+    }
+    
+    std::string prefix = ":" + serverName + " NJOIN ";
+    size_t limit = LineBuffer::MAX_LINE - 2;
+    for (std::map<std::string, Channel*>::iterator it = channels.begin(); it != channels.end(); ++it) {
+        Channel* channel = it->second;
+        std::string head = prefix + channel->getName() + " :";
+        std::string line = head;
+        bool sent = false;
+        
+        const std::vector<Member>& members = channel->getMembers();
+        for (size_t i = 0; i < members.size(); ++i) {
+            if (members[i].client->getRoute() == link) continue;
+            
+            std::string entry;
+            if (members[i].flags & MEMBER_OP) entry += '@';
+            if (members[i].flags & MEMBER_VOICE) entry += '+';
+            entry += members[i].client->getNickname();
+            
+            if (line.size() > head.size() && line.size() + 1 + entry.size() > limit) {
+                link->queueMessage(line);
+                line = head;
+            }
+            if (line.size() > head.size()) line += ',';
+            line += entry;
+            sent = true;
+        }
+        if (!sent) continue;
+        
+        link->queueMessage(line);
+        link->queueMessage(channelSettings(channel));
+    }
+}
+
+void Server::dropLink(Client* link, const std::string& reason) {
+    std::map<Client*, PeerLink>::iterator it = links.find(link);
+    if (it == links.end()) return;
+    
+    std::string name = it->second.name;
+    std::string target = it->second.target;
+    links.erase(it);
+    if (name.empty()) {
+        LOG_INFO << "Link to " << (target.empty() ? link->getIp() : target) << " failed: " << reason;
+        return;
+    }
+    LOG_WARN << "Lost link with " << name << ": " << reason;
+    noticeOpers("Link with " + name + " lost: " + reason);
+    
+    // Everything behind the link is gone for the rest of the tree
+    std::map<std::string, Client*>::iterator server = servers.begin();
+    while (server != servers.end()) {
+        if (server->second == link) {
+            propagate(":" + serverName + " SQUIT " + server->first + " :" + reason, link);
+            servers.erase(server++);
+        } else {
+            ++server;
+        }
+    }
+    
+    // Netsplit: the users quit with the two server names as the reason
+    std::vector<Client*> gone;
+    for (std::set<Client*>::iterator user = remoteUsers.begin(); user != remoteUsers.end(); ++user) {
+        if ((*user)->getRoute() == link)
+            gone.push_back(*user);
+    }
+    for (size_t i = 0; i < gone.size(); ++i)
+        removeRemoteUser(gone[i], serverName + " " + name);
+}
+
+void Server::propagate(const std::string& line, Client* from) {
+    Payload* payload = NULL;
+    for (std::map<Client*, PeerLink>::iterator it = links.begin(); it != links.end(); ++it) {
+        if (it->first == from || it->second.name.empty()) continue;
+        if (!payload)
+            payload = Payload::create(line);
+        it->first->queueMessage(payload);
+    }
+    if (payload)
+        payload->release();
+}
+
+void Server::channelEvent(Channel* channel, const std::string& line, Client* from) {
+    channel->broadcast(line, NULL);
+    propagate(line, from);
+}
+
+void Server::forwardToChannel(Channel* channel, const std::string& line, Client* from) {
+    // Once per link with members behind it, never back where it came from
+    std::set<Client*> routes;
+    const std::vector<Member>& members = channel->getMembers();
+    for (size_t i = 0; i < members.size(); ++i) {
+        Client* route = members[i].client->getRoute();
+        if (route && route != from)
+            routes.insert(route);
+    }
+    if (routes.empty()) return;
+    
+    Payload* payload = Payload::create(line);
+    for (std::set<Client*>::iterator it = routes.begin(); it != routes.end(); ++it)
+        (*it)->queueMessage(payload);
+    payload->release();
+}
+
+void Server::announceJoin(Channel* channel, Client* client, bool created) {
+    if (links.empty()) return;
+    
+    // A new channel's creator is its operator everywhere, and the settings
+    // it may have been restored with go along
+    propagate(":" + serverName + " NJOIN " + channel->getName() + " :" + (created ? "@" : "") +
+              client->getNickname(), NULL);
+    if (created)
+        propagate(channelSettings(channel), NULL);
+}
+
+std::string Server::introduction(Client* client) const {
+    return "NICK " + client->getNickname() + " " + client->getUsername() + " " + client->getIp() +
+           " :" + client->getRealname();
+}
+
+std::string Server::channelSettings(Channel* channel) const {
+    std::ostringstream line;
+    line << ":" << serverName << " CHANSET " << channel->getName() << " " << channel->getCreated() << " +"
+         << (channel->isInviteOnly() ? "i" : "") << (channel->isTopicRestricted() ? "t" : "") << " "
+         << (channel->hasPassword() ? channel->getPassword() : "*") << " " << channel->getUserLimit()
+         << " :" << channel->getTopic();
+    return line.str();
+}
+
+void Server::removeRemoteUser(Client* user, const std::string& reason) {
+    detachClient(user, reason);
+    remoteUsers.erase(user);
+    delete user;
+}
+
+void Server::killUser(Client* user, const std::string& reason, Client* from) {
+    // Sent first, so the QUIT that follows finds nobody left to remove
+    propagate(":" + serverName + " KILL " + user->getNickname() + " :" + reason, from);
+    if (user->isRemote()) {
+        removeRemoteUser(user, "Killed (" + reason + ")");
+    } else {
+        countDisconnect("Killed");
+        disconnectClient(user, "Killed (" + reason + ")");
+    }
+}
+
+const Server::LinkEntry Server::linkTable[] = {
+    {"PRIVMSG", &Server::linkPrivmsg, 2, true, true},
+    {"NICK", &Server::linkNick, 1, false, true},
+    {"NJOIN", &Server::linkNjoin, 2, false, true},
+    {"PART", &Server::linkPart, 1, true, true},
+    {"QUIT", &Server::linkQuit, 0, true, true},
+    {"MODE", &Server::linkMode, 2, true, true},
+    {"TOPIC", &Server::linkTopic, 2, true, true},
+    {"KICK", &Server::linkKick, 2, true, true},
+    {"INVITE", &Server::linkInvite, 2, true, true},
+    {"CHANSET", &Server::linkChanset, 5, false, true},
+    {"KILL", &Server::linkKill, 1, false, true},
+    {"SERVER", &Server::linkServer, 1, false, false},
+    {"SQUIT", &Server::linkSquit, 1, false, true},
+    {"PASS", &Server::linkPass, 1, false, false},
+    {"PING", &Server::linkPing, 0, false, false},
+    {"PONG", &Server::linkPong, 0, false, false},
+    {"ERROR", &Server::linkError, 0, false, false}
+};
+
+void Server::handleLinkLine(Client* link, const MessageView& message, const StringRef& line) {
+    std::map<Client*, PeerLink>::iterator peer = links.find(link);
+    if (peer == links.end()) return;
+    
+    const LinkEntry* entry = NULL;
+    for (size_t i = 0; i < sizeof(linkTable) / sizeof(linkTable[0]) && !entry; ++i) {
+        if (message.command.equalsIgnoreCase(linkTable[i].name))
+            entry = &linkTable[i];
+    }
+    
+    // Until the peer's own SERVER line only the handshake is accepted
+    if (!entry || (entry->requiresRegistration && peer->second.name.empty()) ||
+        message.paramCount < entry->minParams) {
+        LOG_DEBUG << "Ignoring " << message.command << " from server link " << link->getIp();
+        return;
+    }
+    
+    // A user prefix must name someone reached through this very link
+    Client* origin = NULL;
+    if (message.prefix.size) {
+        std::string source = prefixSource(message.prefix);
+        if (source != peer->second.name && !servers.count(source)) {
+            origin = getClientByNickname(source);
+            if (origin && origin->getRoute() != link)
+                origin = NULL;
+        }
+    }
+    if (entry->requiresUser && !origin) {
+        LOG_DEBUG << "Ignoring " << message.command << " from unknown user " << message.prefix.str();
+        return;
+    }
+    
+    Command command(message);
+    (this->*entry->handler)(link, origin, command, line);
+}
+
+void Server::linkPass(Client* link, Client*, const Command& command, const StringRef&) {
+    PeerLink& peer = links[link];
+    if (peer.name.empty())
+        peer.passOk = (command.getParams()[0] == config.linkPassword);
+}
+
+void Server::linkServer(Client* link, Client*, const Command& command, const StringRef& line) {
+    PeerLink& peer = links[link];
+    const std::string& name = command.getParams()[0];
+    
+    // The peer's own SERVER line completes a link we dialed
+    if (peer.name.empty() && !peer.passOk) {
+        countDisconnect("Bad link password");
+        disconnectClient(link, "Bad link password");
+        return;
+    }
+    
+    // A second path to a known server would make a loop
+    if (!isValidServerName(name) || name == serverName || servers.count(name)) {
+        countDisconnect("Server already linked");
+        disconnectClient(link, "Server " + name + " already linked");
+        return;
+    }
+    
+    if (peer.name.empty()) {
+        registerLink(link, name);
+        return;
+    }
+    servers[name] = link;
+    propagate(line.str(), link);
+}
+
+void Server::linkSquit(Client* link, Client*, const Command& command, const StringRef& line) {
+    // Its users are removed by the QUITs that come with the SQUIT
+    std::map<std::string, Client*>::iterator it = servers.find(command.getParams()[0]);
+    if (it == servers.end() || it->second != link) return;
+    
+    servers.erase(it);
+    propagate(line.str(), link);
+}
+
+void Server::linkPing(Client* link, Client*, const Command& command, const StringRef&) {
+    std::string token = command.getParams().empty() ? "" : command.getParams()[0];
+    link->queueMessage("PONG " + serverName + " :" + token);
+}
+
+void Server::linkPong(Client*, Client*, const Command&, const StringRef&) {
+    // The reactor already counted the line as activity for the keepalive
+}
+
+void Server::linkError(Client* link, Client*, const Command& command, const StringRef&) {
+    LOG_WARN << "Server link " << link->getIp() << " reported: "
+             << (command.getParams().empty() ? "" : command.getParams()[0]);
+}
+
+void Server::linkNick(Client* link, Client* origin, const Command& command, const StringRef& line) {
+    const std::vector<std::string>& params = command.getParams();
+    Client* holder = getClientByNickname(params[0]);
+    
+    if (params.size() >= 4) {
+        // Both users lose a nickname taken on each side of the link: the
+        // KILL also reaches the newcomer's own server
+        if (holder) {
+            LOG_WARN << "Nick collision on " << params[0] << " with server link " << link->getIp();
+            killUser(holder, "Nick collision", NULL);
+            return;
+        }
+        
+        Client* user = new Client(-1, params[2], &linkTransport);
+        user->setUsername(params[1]);
+        user->setRealname(params[3]);
+        user->setAuthenticated(true);
+        user->setRoute(link);
+        setClientNickname(user, params[0]);
+        remoteUsers.insert(user);
+        propagate(line.str(), link);
+        return;
+    }
+    
+    if (!origin) return;
+    if (holder && holder != origin) {
+        LOG_WARN << "Nick collision on " << params[0] << " with server link " << link->getIp();
+        killUser(holder, "Nick collision", NULL);
+        killUser(origin, "Nick collision", link);
+        return;
+    }
+    
+    std::string nickMsg = line.str();
+    setClientNickname(origin, params[0]);
+    broadcastToPeers(origin, nickMsg, false);
+    propagate(nickMsg, link);
+}
+
+void Server::linkQuit(Client*, Client* origin, const Command& command, const StringRef&) {
+    removeRemoteUser(origin, command.getParams().empty() ? "Quit" : command.getParams()[0]);
+}
+
+void Server::linkKill(Client* link, Client*, const Command& command, const StringRef&) {
+    Client* target = getClientByNickname(command.getParams()[0]);
+    if (target)
+        killUser(target, command.getParams().size() > 1 ? command.getParams()[1] : "Killed", link);
+}
+
+void Server::linkNjoin(Client* link, Client*, const Command& command, const StringRef& line) {
+    const std::string& name = command.getParams()[0];
+    std::vector<std::string> entries;
+    splitList(command.getParams()[1], entries);
+    
+    Channel* channel = getChannel(name);
+    for (size_t i = 0; i < entries.size(); ++i) {
+        int flags = 0;
+        size_t start = 0;
+        for (; start < entries[i].size() && (entries[i][start] == '@' || entries[i][start] == '+'); ++start)
+            flags |= (entries[i][start] == '@') ? MEMBER_OP : MEMBER_VOICE;
+        
+        Client* member = getClientByNickname(entries[i].substr(start));
+        if (!member || member->getRoute() != link || (channel && channel->hasClient(member)))
+            continue;
+        
+        if (!channel) {
+            // Its settings arrive in the CHANSET that follows, and win
+            channel = createChannel(name, member);
+            channel->setCreated(LONG_MAX);
+            if (!(flags & MEMBER_OP))
+                channel->removeOperator(member);
+        } else {
+            channel->addClient(member);
+            if (flags & MEMBER_OP)
+                channel->addOperator(member);
+        }
+        if (flags & MEMBER_VOICE)
+            channel->setVoice(member, true);
+        
+        channel->broadcast(member->getPrefix() + " JOIN " + name, NULL);
+        if (flags & MEMBER_OP)
+            channel->broadcast(":server MODE " + name + " +o " + member->getNickname(), NULL);
+        if (flags & MEMBER_VOICE)
+            channel->broadcast(":server MODE " + name + " +v " + member->getNickname(), NULL);
+    }
+    propagate(line.str(), link);
+}
+
+// The older channel's settings win; on a tie, those of the server with
+// the lower name. Local members see the differences as server changes.
+void Server::linkChanset(Client* link, Client*, const Command& command, const StringRef& line) {
+    const std::vector<std::string>& params = command.getParams();
+    Channel* channel = getChannel(params[0]);
+    if (!channel) return;
+    
+    time_t created = static_cast<time_t>(std::atol(params[1].c_str()));
+    if (created > channel->getCreated() ||
+        (created == channel->getCreated() && command.getPrefix() >= serverName))
+        return;
+    
+    bool inviteOnly = params[2].find('i') != std::string::npos;
+    bool topicRestricted = params[2].find('t') != std::string::npos;
+    std::string key = (params[3] == "*") ? "" : params[3];
+    int limit = std::atoi(params[4].c_str());
+    std::string topic = params.size() > 5 ? params[5] : "";
+    
+    const std::string& name = channel->getName();
+    bool changed = false;
+    if (inviteOnly != channel->isInviteOnly()) {
+        channel->broadcast(":server MODE " + name + (inviteOnly ? " +i" : " -i"), NULL);
+        channel->setInviteOnly(inviteOnly);
+        changed = true;
+    }
+    if (topicRestricted != channel->isTopicRestricted()) {
+        channel->broadcast(":server MODE " + name + (topicRestricted ? " +t" : " -t"), NULL);
+        channel->setTopicRestricted(topicRestricted);
+        changed = true;
+    }
+    if (key != channel->getPassword()) {
+        channel->broadcast(":server MODE " + name + (key.empty() ? " -k" : " +k " + key), NULL);
+        channel->setPassword(key);
+        changed = true;
+    }
+    if (limit != channel->getUserLimit()) {
+        channel->broadcast(":server MODE " + name + (limit ? " +l " + params[4] : " -l"), NULL);
+        channel->setUserLimit(limit);
+        changed = true;
+    }
+    if (topic != channel->getTopic()) {
+        channel->broadcast(":server TOPIC " + name + " :" + topic, NULL);
+        channel->setTopic(topic);
+        changed = true;
+    }
+    channel->setCreated(created);
+    
+    if (changed)
+        saveChannelState(channel);
+    propagate(line.str(), link);
+}
+
+void Server::linkPart(Client* link, Client* origin, const Command& command, const StringRef& line) {
+    Channel* channel = getChannel(command.getParams()[0]);
+    if (!channel || !channel->hasClient(origin)) return;
+    
+    channelEvent(channel, line.str(), link);
+    channel->removeClient(origin);
+    if (channel->getMemberCount() == 0)
+        removeChannel(channel->getName());
+}
+
+void Server::linkKick(Client* link, Client*, const Command& command, const StringRef& line) {
+    Channel* channel = getChannel(command.getParams()[0]);
+    Client* target = getClientByNickname(command.getParams()[1]);
+    if (!channel || !target || !channel->hasClient(target)) return;
+    
+    channelEvent(channel, line.str(), link);
+    channel->removeClient(target);
+    if (channel->getMemberCount() == 0)
+        removeChannel(channel->getName());
+}
+
+// One change per line, as handleMode relays them
+void Server::linkMode(Client* link, Client*, const Command& command, const StringRef& line) {
+    const std::vector<std::string>& params = command.getParams();
+    Channel* channel = getChannel(params[0]);
+    const std::string& change = params[1];
+    if (!channel || change.size() != 2) return;
+    
+    bool add = (change[0] == '+');
+    std::string arg = params.size() > 2 ? params[2] : "";
+    bool settingsChanged = true;
+    
+    switch (change[1]) {
+    case 'i': channel->setInviteOnly(add); break;
+    case 't': channel->setTopicRestricted(add); break;
+    case 'k': channel->setPassword(add ? arg : ""); break;
+    case 'l': channel->setUserLimit(add ? std::atoi(arg.c_str()) : 0); break;
+    case 'o':
+    case 'v': {
+        Client* target = getClientByNickname(arg);
+        if (!target || !channel->hasClient(target)) return;
+        if (change[1] == 'v')
+            channel->setVoice(target, add);
+        else if (add)
+            channel->addOperator(target);
+        else
+            channel->removeOperator(target);
+        settingsChanged = false;
+        break;
+    }
+    default:
+        return;
+    }
+    
+    channelEvent(channel, line.str(), link);
+    if (settingsChanged)
+        saveChannelState(channel);
+}
+
+void Server::linkTopic(Client* link, Client*, const Command& command, const StringRef& line) {
+    Channel* channel = getChannel(command.getParams()[0]);
+    if (!channel) return;
+    
+    channel->setTopic(command.getParams()[1]);
+    saveChannelState(channel);
+    channelEvent(channel, line.str(), link);
+}
+
+void Server::linkPrivmsg(Client* link, Client* origin, const Command& command, const StringRef& line) {
+    const std::string& target = command.getParams()[0];
+    if (target[0] == '#') {
+        Channel* channel = getChannel(target);
+        if (!channel) return;
+        
+        std::string message = line.str();
+        channel->broadcast(message, origin);
+        forwardToChannel(channel, message, link);
+        return;
+    }
+    
+    // Delivered here, or passed on toward the recipient's own server
+    Client* recipient = getClientByNickname(target);
+    if (recipient && recipient->getRoute() != link)
+        recipient->queueMessage(line.str());
+}
+
+void Server::linkInvite(Client* link, Client*, const Command& command, const StringRef& line) {
+    Client* recipient = getClientByNickname(command.getParams()[0]);
+    if (!recipient || recipient->getRoute() == link) return;
+    
+    // The recipient's own server records the invite for its JOIN
+    if (!recipient->isRemote()) {
+        Channel* channel = getChannel(command.getParams()[1]);
+        if (channel)
+            channel->addInvited(recipient);
+    }
+    recipient->queueMessage(line.str());
+}
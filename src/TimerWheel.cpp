@@ -0,0 +1,122 @@
+#include "../include/TimerWheel.hpp"
+
+Timer::Timer() : prev(NULL), next(NULL), expiry(0), handler(NULL), data(NULL) {
+}
+
+bool Timer::isArmed() const {
+    return next != NULL;
+}
+
+TimerWheel::TimerWheel(unsigned long long tickMs, unsigned long long nowMs)
+    : tickMs(tickMs), current(nowMs / tickMs), count(0) {
+    for (size_t level = 0; level < LEVELS; ++level) {
+        for (size_t slot = 0; slot < SLOTS; ++slot)
+            slots[level][slot].prev = slots[level][slot].next = &slots[level][slot];
+    }
+}
+
+void TimerWheel::link(Timer* timer) {
+    // The level is the first whose slots are wide enough for the distance;
+    // anything past the top level waits in its last slot
+    unsigned long long delta = timer->expiry - current;
+    size_t level = 0;
+    while (level < LEVELS - 1 && delta >= (1ULL << (SLOT_BITS * (level + 1))))
+        ++level;
+    if (delta >= (1ULL << (SLOT_BITS * LEVELS)))
+        timer->expiry = current + (1ULL << (SLOT_BITS * LEVELS)) - 1;
+    
+    Timer* head = &slots[level][(timer->expiry >> (SLOT_BITS * level)) & (SLOTS - 1)];
+    timer->next = head;
+    timer->prev = head->prev;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+void TimerWheel::unlink(Timer* timer) {
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->prev = timer->next = NULL;
+}
+
+void TimerWheel::schedule(Timer* timer, unsigned long long delayMs) {
+    if (timer->isArmed())
+        unlink(timer);
+    else
+        ++count;
+    
+    // Part of the current tick has already gone by, so one more keeps a
+    // timer from ever firing early
+    timer->expiry = current + (delayMs + tickMs - 1) / tickMs + 1;
+    link(timer);
+}
+
+void TimerWheel::cancel(Timer* timer) {
+    if (!timer->isArmed()) return;
+    unlink(timer);
+    --count;
+}
+
+void TimerWheel::cascade(size_t level) {
+    Timer* head = &slots[level][(current >> (SLOT_BITS * level)) & (SLOTS - 1)];
+    while (head->next != head) {
+        Timer* timer = head->next;
+        unlink(timer);
+        link(timer);
+    }
+}
+
+void TimerWheel::advance(unsigned long long nowMs) {
+    unsigned long long target = nowMs / tickMs;
+    
+    while (current < target) {
+        // Nothing to run: skip the idle stretch in one step
+        if (!count) {
+            current = target;
+            return;
+        }
+        ++current;
+        
+        // Each time a level wraps, the next level's slot for the new turn
+        // is spread over the levels below, highest first
+        size_t top = 0;
+        while (top < LEVELS - 1 && !(current & ((1ULL << (SLOT_BITS * (top + 1))) - 1)))
+            ++top;
+        for (size_t level = top; level > 0; --level)
+            cascade(level);
+        
+        // Detach the due list first so handlers can re-arm into any slot
+        Timer* head = &slots[0][current & (SLOTS - 1)];
+        if (head->next == head) continue;
+        
+        Timer due;
+        due.next = head->next;
+        due.prev = head->prev;
+        due.next->prev = &due;
+        due.prev->next = &due;
+        head->next = head->prev = head;
+        
+        while (due.next != &due) {
+            Timer* timer = due.next;
+            unlink(timer);
+            --count;
+            timer->handler->onTimer(timer);
+        }
+    }
+}
+
+int TimerWheel::nextTimeout(unsigned long long nowMs) const {
+    if (!count) return -1;
+    
+    // Look ahead on the lowest level up to its next wrap, where a cascade
+    // may bring in more timers
+    unsigned long long tick = current + 1;
+    while ((tick & (SLOTS - 1)) && slots[0][tick & (SLOTS - 1)].next == &slots[0][tick & (SLOTS - 1)])
+        ++tick;
+    
+    unsigned long long due = tick * tickMs;
+    return due > nowMs ? static_cast<int>(due - nowMs) : 0;
+}
+
+size_t TimerWheel::size() const {
+    return count;
+}
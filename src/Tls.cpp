@@ -0,0 +1,217 @@
+#include "../include/Tls.hpp"
+#include <stdexcept>
+
+#ifdef USE_TLS
+
+#include "../include/Logger.hpp"
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+// Sessions are only resumed by the context that issued them
+static const char SESSION_ID_CONTEXT[] = "ircserv";
+
+static std::string lastError() {
+    char text[256];
+    unsigned long code = ERR_get_error();
+    if (!code) return "unknown error";
+    ERR_error_string_n(code, text, sizeof(text));
+    return text;
+}
+
+TlsContext::TlsContext(const std::string& certFile, const std::string& keyFile) : ctx(NULL) {
+    ctx = SSL_CTX_new(TLS_server_method());
+    if (!ctx)
+        throw std::runtime_error("Failed to create TLS context: " + lastError());
+    
+    if (SSL_CTX_use_certificate_chain_file(ctx, certFile.c_str()) != 1 ||
+        SSL_CTX_use_PrivateKey_file(ctx, keyFile.c_str(), SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(ctx) != 1) {
+        std::string error = lastError();
+        SSL_CTX_free(ctx);
+        throw std::runtime_error("Cannot use TLS certificate " + certFile + ": " + error);
+    }
+    
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+    
+    // KTLS asks OpenSSL to move record encryption into the kernel once the
+    // handshake is done, where the kernel has the tls module; a peer closing
+    // without close_notify reads as a plain end of stream
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS | SSL_OP_IGNORE_UNEXPECTED_EOF);
+    
+    // The send queue retries a partial write with the same bytes rebuilt at
+    // another address, and idle connections give their buffers back
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER |
+                          SSL_MODE_RELEASE_BUFFERS);
+    
+    // Resumption: a server-side cache for TLS 1.2 session ids, and tickets
+    // sealed with this context's keys, which every reactor thread shares
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_set_session_id_context(ctx, reinterpret_cast<const unsigned char*>(SESSION_ID_CONTEXT),
+                                   sizeof(SESSION_ID_CONTEXT) - 1);
+}
+
+TlsContext::~TlsContext() {
+    SSL_CTX_free(ctx);
+}
+
+TlsSession* TlsContext::accept(int fd) {
+    SSL* ssl = SSL_new(ctx);
+    if (!ssl) return NULL;
+    if (SSL_set_fd(ssl, fd) != 1) {
+        SSL_free(ssl);
+        return NULL;
+    }
+    SSL_set_accept_state(ssl);
+    return new TlsSession(ssl);
+}
+
+TlsSession::TlsSession(ssl_st* ssl) : ssl(ssl), established(false) {
+}
+
+TlsSession::~TlsSession() {
+    SSL_free(ssl);
+}
+
+TlsSession::Result TlsSession::status(int ret) {
+    switch (SSL_get_error(ssl, ret)) {
+    case SSL_ERROR_WANT_READ:
+        return WANT_READ;
+    case SSL_ERROR_WANT_WRITE:
+        return WANT_WRITE;
+    case SSL_ERROR_ZERO_RETURN:
+        return CLOSED;
+    default:
+        return FAILED;
+    }
+}
+
+TlsSession::Result TlsSession::handshake() {
+    if (established) return OK;
+    
+    // The error queue is per thread and must not hold anything stale
+    ERR_clear_error();
+    int ret = SSL_do_handshake(ssl);
+    if (ret == 1) {
+        established = true;
+        return OK;
+    }
+    Result result = status(ret);
+    if (result == FAILED)
+        LOG_DEBUG << "TLS handshake failed: " << lastError();
+    return result;
+}
+
+bool TlsSession::isEstablished() const {
+    return established;
+}
+
+TlsSession::Result TlsSession::read(char* buffer, size_t size, size_t& done) {
+    ERR_clear_error();
+    int ret = SSL_read(ssl, buffer, static_cast<int>(size));
+    if (ret > 0) {
+        done = ret;
+        return OK;
+    }
+    return status(ret);
+}
+
+TlsSession::Result TlsSession::write(const char* data, size_t size, size_t& done) {
+    ERR_clear_error();
+    int ret = SSL_write(ssl, data, static_cast<int>(size));
+    if (ret > 0) {
+        done = ret;
+        return OK;
+    }
+    return status(ret);
+}
+
+bool TlsSession::hasPendingInput() const {
+    return SSL_pending(ssl) > 0;
+}
+
+bool TlsSession::isKernelSend() const {
+    return BIO_get_ktls_send(SSL_get_wbio(ssl)) > 0;
+}
+
+bool TlsSession::isResumed() const {
+    return SSL_session_reused(ssl) == 1;
+}
+
+std::string TlsSession::describe() const {
+    std::string text = SSL_get_version(ssl);
+    text += " ";
+    text += SSL_get_cipher_name(ssl);
+    if (isResumed())
+        text += ", resumed";
+    if (isKernelSend())
+        text += ", kTLS";
+    return text;
+}
+
+void TlsSession::shutdown() {
+    if (!established) return;
+    ERR_clear_error();
+    SSL_shutdown(ssl);
+}
+
+#else
+
+// Built without OpenSSL: the options parse, but a TLS port cannot open
+
+TlsContext::TlsContext(const std::string&, const std::string&) : ctx(NULL) {
+    throw std::runtime_error("TLS support not built in (rebuild with make USE_TLS=1)");
+}
+
+TlsContext::~TlsContext() {
+}
+
+TlsSession* TlsContext::accept(int) {
+    return NULL;
+}
+
+TlsSession::TlsSession(ssl_st* ssl) : ssl(ssl), established(false) {
+}
+
+TlsSession::~TlsSession() {
+}
+
+TlsSession::Result TlsSession::status(int) {
+    return FAILED;
+}
+
+TlsSession::Result TlsSession::handshake() {
+    return FAILED;
+}
+
+bool TlsSession::isEstablished() const {
+    return established;
+}
+
+TlsSession::Result TlsSession::read(char*, size_t, size_t&) {
+    return FAILED;
+}
+
+TlsSession::Result TlsSession::write(const char*, size_t, size_t&) {
+    return FAILED;
+}
+
+bool TlsSession::hasPendingInput() const {
+    return false;
+}
+
+bool TlsSession::isKernelSend() const {
+    return false;
+}
+
+bool TlsSession::isResumed() const {
+    return false;
+}
+
+std::string TlsSession::describe() const {
+    return "";
+}
+
+void TlsSession::shutdown() {
+}
+
+#endif
@@ -0,0 +1,27 @@
+#include "../include/TokenBucket.hpp"
+
+TokenBucket::TokenBucket() : tokens(0), updated(0) {
+}
+
+bool TokenBucket::ready(unsigned long long now, double burst, double rate) {
+    if (!updated) {
+        // New connections start with a full bucket
+        tokens = burst;
+    } else if (now > updated) {
+        tokens += (now - updated) * rate / 1e9;
+        if (tokens > burst) tokens = burst;
+    }
+    updated = now;
+    return tokens > 0;
+}
+
+void TokenBucket::take(double cost) {
+    tokens -= cost;
+}
+
+unsigned long long TokenBucket::nanosUntilReady(double rate) const {
+    if (tokens > 0) return 0;
+    
+    // Just past zero, so the next ready() is not defeated by rounding
+    return static_cast<unsigned long long>((1e-3 - tokens) * 1e9 / rate);
+}
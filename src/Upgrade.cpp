@@ -0,0 +1,217 @@
+#include "../include/Upgrade.hpp"
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+// Below the kernel's SCM_MAX_FD of 253 descriptors per message
+static const size_t FD_BATCH = 250;
+
+static const char READY = 'R';
+
+void StateWriter::putInt(unsigned long long value) {
+    buffer.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void StateWriter::putString(const std::string& value) {
+    putInt(value.size());
+    buffer += value;
+}
+
+const std::string& StateWriter::data() const {
+    return buffer;
+}
+
+StateReader::StateReader(const std::string& buffer) : buffer(buffer), pos(0), failed(false) {
+}
+
+unsigned long long StateReader::getInt() {
+    unsigned long long value = 0;
+    if (failed || buffer.size() - pos < sizeof(value)) {
+        failed = true;
+        return 0;
+    }
+    memcpy(&value, buffer.data() + pos, sizeof(value));
+    pos += sizeof(value);
+    return value;
+}
+
+std::string StateReader::getString() {
+    unsigned long long size = getInt();
+    if (failed || buffer.size() - pos < size) {
+        failed = true;
+        return std::string();
+    }
+    std::string value(buffer, pos, size);
+    pos += size;
+    return value;
+}
+
+bool StateReader::ok() const {
+    return !failed;
+}
+
+static bool writeAll(int sock, const char* data, size_t size) {
+    while (size) {
+        ssize_t n = write(sock, data, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool readAll(int sock, char* data, size_t size) {
+    while (size) {
+        ssize_t n = read(sock, data, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+int spawnSuccessor(const std::vector<std::string>& arguments, pid_t& pid) {
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) == -1)
+        return -1;
+    
+    // Everything the child needs is prepared here: between fork() and
+    // exec() only async-signal-safe calls are allowed
+    char fdOption[32];
+    snprintf(fdOption, sizeof(fdOption), "--upgrade-fd=%d", UPGRADE_FD);
+    std::vector<std::string> args(arguments);
+    args.push_back(fdOption);
+    std::vector<char*> argv;
+    for (size_t i = 0; i < args.size(); ++i)
+        argv.push_back(const_cast<char*>(args[i].c_str()));
+    argv.push_back(NULL);
+    
+    struct rlimit limit;
+    int maxFd = (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY)
+                ? static_cast<int>(limit.rlim_cur) : 65536;
+    
+    pid = fork();
+    if (pid == -1) {
+        close(pair[0]);
+        close(pair[1]);
+        return -1;
+    }
+    
+    if (pid == 0) {
+        // Inherited client sockets would stay open in the successor and keep
+        // connections alive after it closes them, so drop everything
+        if (pair[1] == UPGRADE_FD)
+            fcntl(UPGRADE_FD, F_SETFD, 0);
+        else if (dup2(pair[1], UPGRADE_FD) == -1)
+            _exit(127);
+#ifdef SYS_close_range
+        if (syscall(SYS_close_range, UPGRADE_FD + 1, ~0U, 0) != 0)
+#endif
+            for (int fd = UPGRADE_FD + 1; fd < maxFd; ++fd)
+                close(fd);
+        execvp(argv[0], &argv[0]);
+        _exit(127);
+    }
+    
+    close(pair[1]);
+    return pair[0];
+}
+
+bool sendState(int sock, const std::string& state, const std::vector<int>& fds) {
+    unsigned long long header[2] = {state.size(), fds.size()};
+    if (!writeAll(sock, reinterpret_cast<const char*>(header), sizeof(header)) ||
+        !writeAll(sock, state.data(), state.size()))
+        return false;
+    
+    // One byte per batch carries the descriptors
+    for (size_t sent = 0; sent < fds.size(); sent += FD_BATCH) {
+        size_t count = std::min(FD_BATCH, fds.size() - sent);
+        char control[CMSG_SPACE(sizeof(int) * FD_BATCH)];
+        memset(control, 0, sizeof(control));
+        
+        char byte = 0;
+        struct iovec iov = {&byte, 1};
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+        
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+        memcpy(CMSG_DATA(cmsg), &fds[sent], sizeof(int) * count);
+        
+        ssize_t n;
+        do {
+            n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+        } while (n < 0 && errno == EINTR);
+        if (n != 1) return false;
+    }
+    return true;
+}
+
+bool waitForSuccessor(int sock, int timeoutMs) {
+    struct pollfd pfd = {sock, POLLIN, 0};
+    int ready;
+    do {
+        ready = poll(&pfd, 1, timeoutMs);
+    } while (ready < 0 && errno == EINTR);
+    
+    char reply = 0;
+    return ready == 1 && read(sock, &reply, 1) == 1 && reply == READY;
+}
+
+bool receiveState(int sock, std::string& state, std::vector<int>& fds) {
+    unsigned long long header[2];
+    if (!readAll(sock, reinterpret_cast<char*>(header), sizeof(header)))
+        return false;
+    
+    state.resize(header[0]);
+    if (header[0] && !readAll(sock, &state[0], header[0]))
+        return false;
+    
+    // Reading a single byte at a time keeps each batch's descriptors apart
+    while (fds.size() < header[1]) {
+        char control[CMSG_SPACE(sizeof(int) * FD_BATCH)];
+        char byte;
+        struct iovec iov = {&byte, 1};
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        
+        ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+        if (n < 0 && errno == EINTR) continue;
+        if (n != 1) return false;
+        
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+            size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            const int* received = reinterpret_cast<const int*>(CMSG_DATA(cmsg));
+            fds.insert(fds.end(), received, received + count);
+        }
+    }
+    return true;
+}
+
+void confirmHandoff(int sock) {
+    char ready = READY;
+    writeAll(sock, &ready, 1);
+    close(sock);
+}
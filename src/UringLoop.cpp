@@ -0,0 +1,483 @@
+#include "../include/UringLoop.hpp"
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <ctime>
+#include <poll.h>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+
+// Requests queued per loop iteration before an early submit is forced
+static const unsigned SQ_ENTRIES = 1024;
+static const unsigned CQ_ENTRIES = 8192;
+
+// Receive buffers shared by every client of the loop: a wakeup can hand out
+// all of them, and they return to the kernel at the start of the next one
+static const unsigned BUFFER_COUNT = 256;
+static const size_t BUFFER_SIZE = 4096;
+static const unsigned short BUFFER_GROUP = 0;
+
+// A failed multishot accept (EMFILE, ENFILE, ENOMEM) is retried this much
+// later; started again at once it would fail the same way in a loop
+static const int ACCEPT_RETRY_MS = 100;
+
+enum {
+    OP_POLL = 1,
+    OP_ACCEPT,
+    OP_RECV,
+    OP_SEND
+};
+
+// user_data: the operation in the top byte, then the fd's generation, then the fd
+static unsigned long long makeTag(int op, unsigned generation, int fd) {
+    return (static_cast<unsigned long long>(op) << 56) |
+           (static_cast<unsigned long long>(generation & 0xffffff) << 32) | static_cast<unsigned>(fd);
+}
+
+static long long monotonicMillis() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<long long>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int ioUringSetup(unsigned entries, io_uring_params* params) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int ioUringEnter(int fd, unsigned submit, unsigned wait, unsigned flags, void* arg, size_t size) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, submit, wait, flags, arg, size));
+}
+
+static int ioUringRegister(int fd, unsigned opcode, void* arg, unsigned count) {
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, count));
+}
+
+UringLoop::Slot::Slot()
+    : generation(0), events(0), accepting(false), receiving(false), sending(false), send(NULL) {
+}
+
+UringLoop::UringLoop()
+    : ringFd(-1), ringMemory(MAP_FAILED), ringSize(0), sqes(NULL), sqesSize(0), pending(0),
+      bufferRing(NULL), buffers(NULL) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+    params.cq_entries = CQ_ENTRIES;
+    
+    ringFd = ioUringSetup(SQ_ENTRIES, &params);
+    if (ringFd == -1)
+        throw std::runtime_error(std::string("io_uring unavailable: ") + strerror(errno));
+    
+    // One mapping for both rings, the timed wait, and no lost completions
+    unsigned needed = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_EXT_ARG | IORING_FEAT_NODROP;
+    if ((params.features & needed) != needed) {
+        close(ringFd);
+        throw std::runtime_error("io_uring too old for this server");
+    }
+    
+    ringSize = std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                        params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+    ringMemory = mmap(NULL, ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqeMemory = mmap(NULL, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    if (ringMemory == MAP_FAILED || sqeMemory == MAP_FAILED) {
+        if (sqeMemory != MAP_FAILED) munmap(sqeMemory, sqesSize);
+        if (ringMemory != MAP_FAILED) munmap(ringMemory, ringSize);
+        close(ringFd);
+        throw std::runtime_error("Failed to map io_uring rings");
+    }
+    sqes = static_cast<io_uring_sqe*>(sqeMemory);
+    
+    char* base = static_cast<char*>(ringMemory);
+    sqHead = reinterpret_cast<unsigned*>(base + params.sq_off.head);
+    sqTail = reinterpret_cast<unsigned*>(base + params.sq_off.tail);
+    sqMask = *reinterpret_cast<unsigned*>(base + params.sq_off.ring_mask);
+    sqEntries = params.sq_entries;
+    sqArray = reinterpret_cast<unsigned*>(base + params.sq_off.array);
+    cqHead = reinterpret_cast<unsigned*>(base + params.cq_off.head);
+    cqTail = reinterpret_cast<unsigned*>(base + params.cq_off.tail);
+    cqMask = *reinterpret_cast<unsigned*>(base + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe*>(base + params.cq_off.cqes);
+    
+    // The ring of receive buffers, filled once and registered
+    size_t ringBytes = BUFFER_COUNT * sizeof(io_uring_buf);
+    void* ring = mmap(NULL, ringBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    void* data = mmap(NULL, BUFFER_COUNT * BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<unsigned long>(ring);
+    reg.ring_entries = BUFFER_COUNT;
+    reg.bgid = BUFFER_GROUP;
+    if (ring == MAP_FAILED || data == MAP_FAILED ||
+        ioUringRegister(ringFd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        if (ring != MAP_FAILED) munmap(ring, ringBytes);
+        if (data != MAP_FAILED) munmap(data, BUFFER_COUNT * BUFFER_SIZE);
+        munmap(sqes, sqesSize);
+        munmap(ringMemory, ringSize);
+        close(ringFd);
+        throw std::runtime_error("io_uring buffer rings unavailable");
+    }
+    bufferRing = static_cast<io_uring_buf*>(ring);
+    buffers = static_cast<char*>(data);
+    for (unsigned i = 0; i < BUFFER_COUNT; ++i)
+        used.push_back(static_cast<unsigned short>(i));
+    recycleBuffers();
+}
+
+UringLoop::~UringLoop() {
+    // Closing the ring cancels whatever is still in flight
+    close(ringFd);
+    munmap(sqes, sqesSize);
+    munmap(ringMemory, ringSize);
+    munmap(bufferRing, BUFFER_COUNT * sizeof(io_uring_buf));
+    munmap(buffers, BUFFER_COUNT * BUFFER_SIZE);
+    for (size_t i = 0; i < slots.size(); ++i)
+        delete slots[i].send;
+}
+
+UringLoop::Slot* UringLoop::find(int fd) {
+    if (fd < 0 || static_cast<size_t>(fd) >= slots.size())
+        return NULL;
+    return &slots[fd];
+}
+
+UringLoop::Slot& UringLoop::slot(int fd) {
+    if (static_cast<size_t>(fd) >= slots.size())
+        slots.resize(fd + 1);
+    return slots[fd];
+}
+
+io_uring_sqe* UringLoop::nextSqe() {
+    // A full queue goes in early rather than waiting for the loop; if the
+    // kernel takes none of it, there is no free entry to hand out
+    unsigned tail = *sqTail;
+    if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries &&
+        (!submit() || tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries))
+        return NULL;
+    
+    unsigned index = tail & sqMask;
+    io_uring_sqe* sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqArray[index] = index;
+    __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+    ++pending;
+    return sqe;
+}
+
+bool UringLoop::submit() {
+    while (pending) {
+        int submitted = ioUringEnter(ringFd, pending, 0, 0, NULL, 0);
+        if (submitted < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        pending -= std::min(pending, static_cast<unsigned>(submitted));
+    }
+    return true;
+}
+
+static unsigned toPollMask(int events) {
+    unsigned mask = POLLRDHUP;
+    if (events & EVENT_READ) mask |= POLLIN;
+    if (events & EVENT_WRITE) mask |= POLLOUT;
+    return mask;
+}
+
+bool UringLoop::queuePoll(int fd) {
+    Slot& state = slot(fd);
+    io_uring_sqe* sqe = nextSqe();
+    if (!sqe) return false;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = toPollMask(state.events);
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = makeTag(OP_POLL, state.generation, fd);
+    return true;
+}
+
+bool UringLoop::queueAccept(int fd) {
+    io_uring_sqe* sqe = nextSqe();
+    if (!sqe) return false;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = makeTag(OP_ACCEPT, slot(fd).generation, fd);
+    return true;
+}
+
+bool UringLoop::queueRecv(int fd) {
+    io_uring_sqe* sqe = nextSqe();
+    if (!sqe) return false;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUFFER_GROUP;
+    sqe->user_data = makeTag(OP_RECV, slot(fd).generation, fd);
+    return true;
+}
+
+bool UringLoop::queue(int fd, int op) {
+    if (op == OP_POLL) return queuePoll(fd);
+    if (op == OP_ACCEPT) return queueAccept(fd);
+    return queueRecv(fd);
+}
+
+void UringLoop::rearm(int fd, int op, unsigned generation, int delayMs) {
+    Rearm entry = {fd, op, generation, delayMs ? monotonicMillis() + delayMs : 0};
+    rearms.push_back(entry);
+}
+
+// Starts the multishot requests that are due and still wanted; returns the
+// wait timeout, shortened to the next one that is not due yet
+int UringLoop::startRearms(int timeoutMs) {
+    long long now = 0;
+    size_t kept = 0;
+    for (size_t i = 0; i < rearms.size(); ++i) {
+        Rearm& entry = rearms[i];
+        Slot* state = find(entry.fd);
+        if (!state || state->generation != entry.generation) continue;
+        if ((entry.op == OP_POLL && !state->events) || (entry.op == OP_ACCEPT && !state->accepting) ||
+            (entry.op == OP_RECV && !state->receiving))
+            continue;
+        
+        if (entry.due) {
+            if (!now) now = monotonicMillis();
+            if (entry.due > now) {
+                int wait = static_cast<int>(entry.due - now);
+                if (timeoutMs < 0 || wait < timeoutMs) timeoutMs = wait;
+                rearms[kept++] = entry;
+                continue;
+            }
+        }
+        if (!queue(entry.fd, entry.op)) {
+            entry.due = 0;
+            rearms[kept++] = entry;
+            timeoutMs = 0;
+        }
+    }
+    rearms.resize(kept);
+    return timeoutMs;
+}
+
+bool UringLoop::add(int fd, int events) {
+    if (fd < 0) return false;
+    Slot& state = slot(fd);
+    if (state.events) return false;
+    
+    state.events = events;
+    if (!queuePoll(fd)) {
+        state.events = 0;
+        return false;
+    }
+    return true;
+}
+
+bool UringLoop::modify(int fd, int events) {
+    Slot* state = find(fd);
+    if (!state || !state->events) return false;
+    
+    // Cancelling makes the old poll's completions stale, then it starts over
+    remove(fd);
+    return add(fd, events);
+}
+
+void UringLoop::remove(int fd) {
+    Slot* state = find(fd);
+    if (!state) return;
+    
+    if (state->events || state->accepting || state->receiving || state->sending) {
+        // Requests still queued for the fd go in first, so the cancel
+        // finds them all; it returns once none is left running
+        submit();
+        io_uring_sync_cancel_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.fd = fd;
+        reg.flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+        reg.timeout.tv_sec = -1;
+        reg.timeout.tv_nsec = -1;
+        ioUringRegister(ringFd, IORING_REGISTER_SYNC_CANCEL, &reg, 1);
+    }
+    ++state->generation;
+    state->events = 0;
+    state->accepting = false;
+    state->receiving = false;
+    state->sending = false;
+}
+
+void UringLoop::recycleBuffers() {
+    if (used.empty()) return;
+    
+    // io_uring_buf_ring is laid out for C; in C++ its flexible array starts
+    // 8 bytes late, so the entries are indexed directly. The tail shares
+    // the first entry's resv field, and only this thread writes it.
+    unsigned short* tailField = &bufferRing[0].resv;
+    unsigned short tail = *tailField;
+    for (size_t i = 0; i < used.size(); ++i, ++tail) {
+        io_uring_buf* buffer = &bufferRing[tail & (BUFFER_COUNT - 1)];
+        buffer->addr = reinterpret_cast<unsigned long>(buffers + used[i] * BUFFER_SIZE);
+        buffer->len = BUFFER_SIZE;
+        buffer->bid = used[i];
+    }
+    __atomic_store_n(tailField, tail, __ATOMIC_RELEASE);
+    used.clear();
+}
+
+int UringLoop::wait(std::vector<IoEvent>& events, int timeoutMs) {
+    events.clear();
+    
+    // The data of the last batch has been consumed: its buffers go back,
+    // and receives that ran out of them start again with anything else due
+    recycleBuffers();
+    if (!rearms.empty())
+        timeoutMs = startRearms(timeoutMs);
+    
+    // Submitting and waiting is a single call; completions reaped since the
+    // last one (by a remove()) mean there is no need to wait at all
+    __kernel_timespec timeout;
+    timeout.tv_sec = timeoutMs / 1000;
+    timeout.tv_nsec = static_cast<long long>(timeoutMs % 1000) * 1000000;
+    io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    if (timeoutMs >= 0)
+        arg.ts = reinterpret_cast<unsigned long>(&timeout);
+    
+    bool ready = *cqHead != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+    int submitted = ioUringEnter(ringFd, pending, ready ? 0 : 1,
+                                 IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    if (submitted >= 0)
+        pending -= std::min(pending, static_cast<unsigned>(submitted));
+    else if (errno != ETIME && errno != EINTR && errno != EBUSY)
+        return -1;
+    
+    // Each entry is handed back before it is handled, so requests queued
+    // meanwhile find room for their completions
+    unsigned head = *cqHead;
+    unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        io_uring_cqe cqe = cqes[head & cqMask];
+        __atomic_store_n(cqHead, ++head, __ATOMIC_RELEASE);
+        complete(&cqe, events);
+    }
+    return static_cast<int>(events.size());
+}
+
+void UringLoop::complete(const io_uring_cqe* cqe, std::vector<IoEvent>& events) {
+    int op = static_cast<int>(cqe->user_data >> 56);
+    unsigned generation = static_cast<unsigned>(cqe->user_data >> 32) & 0xffffff;
+    int fd = static_cast<int>(cqe->user_data & 0xffffffff);
+    bool more = cqe->flags & IORING_CQE_F_MORE;
+    int res = cqe->res;
+    
+    int buffer = -1;
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+        buffer = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        used.push_back(static_cast<unsigned short>(buffer));
+    }
+    
+    Slot* state = find(fd);
+    if (!state || (state->generation & 0xffffff) != generation)
+        return;
+    
+    IoEvent event = {fd, 0, res, NULL};
+    if (op == OP_POLL) {
+        // Multishot requests can end on their own; keep them going
+        if (!more && state->events && res != -ECANCELED && !queuePoll(fd))
+            rearm(fd, OP_POLL, state->generation, 0);
+        if (res < 0) {
+            if (res == -ECANCELED) return;
+            event.events = EVENT_ERROR;
+        } else {
+            if (res & POLLIN) event.events |= EVENT_READ;
+            if (res & POLLOUT) event.events |= EVENT_WRITE;
+            if (res & (POLLERR | POLLHUP | POLLRDHUP)) event.events |= EVENT_ERROR;
+        }
+    } else if (op == OP_ACCEPT) {
+        if (res == -ECANCELED) return;
+        // An error ends the request; it is started again after a pause
+        if (res < 0)
+            rearm(fd, OP_ACCEPT, state->generation, ACCEPT_RETRY_MS);
+        else if (!more && !queueAccept(fd))
+            rearm(fd, OP_ACCEPT, state->generation, 0);
+        event.events = EVENT_ACCEPTED;
+    } else if (op == OP_RECV) {
+        // Out of buffers: wait() starts it again once some are back
+        if (res == -ENOBUFS) {
+            rearm(fd, OP_RECV, state->generation, 0);
+            return;
+        }
+        if (res > 0) {
+            if (!more && !queueRecv(fd))
+                rearm(fd, OP_RECV, state->generation, 0);
+            event.data = buffers + buffer * BUFFER_SIZE;
+        } else {
+            state->receiving = false;
+            if (res == -ECANCELED) return;
+        }
+        event.events = EVENT_RECEIVED;
+    } else if (op == OP_SEND) {
+        state->sending = false;
+        event.events = EVENT_SENT;
+    }
+    events.push_back(event);
+}
+
+bool UringLoop::isEdgeTriggered() const {
+    return true;
+}
+
+const char* UringLoop::getName() const {
+    return "io_uring";
+}
+
+bool UringLoop::accept(int listenFd) {
+    if (listenFd < 0) return false;
+    Slot& state = slot(listenFd);
+    if (state.accepting || !queueAccept(listenFd)) return false;
+    state.accepting = true;
+    return true;
+}
+
+bool UringLoop::receive(int fd) {
+    if (fd < 0) return false;
+    Slot& state = slot(fd);
+    if (state.receiving || !queueRecv(fd)) return false;
+    state.receiving = true;
+    return true;
+}
+
+iovec* UringLoop::prepareSend(int fd) {
+    Slot& state = slot(fd);
+    if (state.sending) return NULL;
+    if (!state.send)
+        state.send = new Send;
+    return state.send->iov;
+}
+
+bool UringLoop::send(int fd, int count) {
+    Slot& state = slot(fd);
+    io_uring_sqe* sqe = nextSqe();
+    if (!sqe) return false;
+    memset(&state.send->msg, 0, sizeof(state.send->msg));
+    state.send->msg.msg_iov = state.send->iov;
+    state.send->msg.msg_iovlen = count;
+    state.sending = true;
+    
+    // MSG_NOSIGNAL as in Client::flushSendQueue
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<unsigned long>(&state.send->msg);
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = makeTag(OP_SEND, state.generation, fd);
+    return true;
+}
+
+bool UringLoop::isSending(int fd) const {
+    if (fd < 0 || static_cast<size_t>(fd) >= slots.size())
+        return false;
+    return slots[fd].sending;
+}
@@ -1,16 +1,18 @@
 #include <iostream>
 #include <cstdlib>
 #include <signal.h>
+#include <unistd.h>
+#include <climits>
 #include "../include/Server.hpp"
 
 Server* g_server = NULL;
 
 void signalHandler(int signal) {
-    if (signal == SIGINT || signal == SIGTERM) {
-        std::cout << "\nShutting down IRC server..." << std::endl;
-        delete g_server;
-        exit(0);
-    }
+    // Only stop the loops here; main() deletes the server once start() returns
+    if ((signal == SIGINT || signal == SIGTERM) && g_server)
+        g_server->stop();
+    else if (signal == SIGUSR2 && g_server)
+        g_server->requestUpgrade();
 }
 
 void is_valid_port(char *str)
@@ -30,32 +32,91 @@ void is_valid_port(char *str)
 }
 
 int main(int argc, char* argv[]) {
-    if (argc != 3) {
-        std::cerr << "Usage: " << argv[0] << " <port> <password>" << std::endl;
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " <port> <password> [threads] [--backend=epoll|poll|uring] [--sendq=bytes]"
+                  << " [--log-level=debug|info|warn|error] [--oper-password=password] [--stats-socket=path] [--targmax=n]"
+                  << " [--flood-burst=n] [--flood-rate=n] [--ping-interval=s] [--ping-timeout=s]"
+                  << " [--registration-timeout=s] [--state-file=path]"
+                  << " [--server-name=name] [--link-password=password] [--connect=ip:port]..."
+                  << " [--tls-port=port --tls-cert=path [--tls-key=path]]" << std::endl;
         return 1;
     }
     is_valid_port(argv[1]);
     int port = std::atoi(argv[1]);
     std::string password = argv[2];
     
+    ServerConfig config;
+    int first = 3;
+    if (argc > 3 && std::string(argv[3]).compare(0, 2, "--") != 0) {
+        if (!config.parseThreads(argv[3])) {
+            std::cerr << "Error: Thread count must be between 1 and 64" << std::endl;
+            return 1;
+        }
+        first = 4;
+    }
+    for (int i = first; i < argc; ++i) {
+        if (!config.parseOption(argv[i])) {
+            std::cerr << "Error: Invalid option " << argv[i] << std::endl;
+            return 1;
+        }
+    }
+    
+    if (!config.connectTo.empty() && config.linkPassword.empty()) {
+        std::cerr << "Error: --connect needs --link-password" << std::endl;
+        return 1;
+    }
     if (port <= 0 || port > 65535) {
         std::cerr << "Error: Port must be between 1 and 65535" << std::endl;
         return 1;
     }
+    if (config.tlsPort && config.tlsCert.empty()) {
+        std::cerr << "Error: --tls-port needs --tls-cert" << std::endl;
+        return 1;
+    }
+    if (config.tlsPort == port) {
+        std::cerr << "Error: --tls-port must differ from the plaintext port" << std::endl;
+        return 1;
+    }
+    if (config.tlsKey.empty())
+        config.tlsKey = config.tlsCert;
+    
+    // Command line for a live upgrade: the same options, minus the handoff
+    // socket this process may itself have been given
+    char path[PATH_MAX];
+    config.arguments.push_back(realpath(argv[0], path) ? path : argv[0]);
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]).compare(0, 13, "--upgrade-fd=") != 0)
+            config.arguments.push_back(argv[i]);
+    }
     
     // Set up signal handling
     signal(SIGINT, signalHandler);
+    signal(SIGUSR2, signalHandler);
+    // OpenSSL writes with plain write(), which has no MSG_NOSIGNAL
+    if (config.tlsPort)
+        signal(SIGPIPE, SIG_IGN);
     // signal(SIGTERM, signalHandler);
     
+    Logger::start(config.logLevel);
+    
     try {
-        g_server = new Server(port, password);
+        g_server = new Server(port, password, config);
         g_server->start();
+        if (g_server->hasHandedOff()) {
+            // The sockets now belong to the new process: leave without
+            // running destructors that would close or unlink anything
+            Logger::shutdown();
+            _exit(0);
+        }
+        LOG_INFO << "Shutting down IRC server...";
     } catch (const std::exception& e) {
-        std::cerr << "Error: " << e.what() << std::endl;
+        LOG_ERROR << "Error: " << e.what();
         delete g_server;
+        Logger::shutdown();
         return 1;
     }
     
     delete g_server;
+    Logger::shutdown();
     return 0;
 }
\ No newline at end of file
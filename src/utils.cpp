@@ -26,4 +26,30 @@ std::string trim(const std::string& str) {
         std::not1(std::ptr_fun<int, int>(std::isspace))).base(), result.end());
     
     return result;
-}
\ No newline at end of file
+}
+
+std::string ircCaseFold(const std::string& str) {
+    std::string result = str;
+    for (size_t i = 0; i < result.size(); ++i) {
+        char c = result[i];
+        if (c >= 'A' && c <= ']')  // A-Z plus [ \ ]
+            result[i] = c + ('a' - 'A');
+        else if (c == '~')
+            result[i] = '^';
+    }
+    return result;
+}
+
+void splitList(const std::string& list, std::vector<std::string>& items) {
+    items.clear();
+    size_t start = 0;
+    for (;;) {
+        size_t comma = list.find(',', start);
+        if (comma == std::string::npos) {
+            items.push_back(list.substr(start));
+            return;
+        }
+        items.push_back(list.substr(start, comma - start));
+        start = comma + 1;
+    }
+}
@@ -0,0 +1,363 @@
+// Microbenchmarks for the per-line hot paths: parsing, framing, case
+// mapping, reply prefix building and channel fan-out. Each case runs until
+// it has taken long enough to time, then reports ns/op and heap
+// allocations/op counted by the replaced global operator new.
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <new>
+#include <unistd.h>
+#include "../include/MessageView.hpp"
+#include "../include/Command.hpp"
+#include "../include/LineBuffer.hpp"
+#include "../include/Client.hpp"
+#include "../include/Channel.hpp"
+#include "../include/Payload.hpp"
+#include "../include/TimerWheel.hpp"
+#include "../include/ChannelStore.hpp"
+#include "../include/Logger.hpp"
+#include "../include/utils.hpp"
+
+// Per thread: the logger and state-file writer threads allocate too, and
+// only the benchmarking thread's allocations belong in the results
+static __thread size_t allocations = 0;
+
+// These replace the global allocator, so pairing them with malloc/free is intended
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+void* operator new(size_t size) throw(std::bad_alloc) {
+    ++allocations;
+    void* p = std::malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size) throw(std::bad_alloc) {
+    return operator new(size);
+}
+
+void operator delete(void* p) throw() {
+    std::free(p);
+}
+
+void operator delete[](void* p) throw() {
+    std::free(p);
+}
+
+// Results feed this so the optimizer cannot drop the work
+static volatile size_t sink;
+
+static const char* PRIVMSG_LINE =
+    ":alice!alice@127.0.0.1 PRIVMSG #general :hello there, how is everyone doing today?";
+
+// A benchmark runs `iterations` operations and returns how many it did
+typedef size_t (*BenchFunction)(size_t iterations);
+
+static size_t benchParseView(size_t iterations) {
+    size_t length = strlen(PRIVMSG_LINE);
+    for (size_t i = 0; i < iterations; ++i) {
+        MessageView message;
+        parseMessage(PRIVMSG_LINE, length, message);
+        sink = message.paramCount;
+    }
+    return iterations;
+}
+
+static size_t benchCommandFromString(size_t iterations) {
+    std::string raw(PRIVMSG_LINE);
+    for (size_t i = 0; i < iterations; ++i) {
+        Command command(raw);
+        sink = command.getParams().size();
+    }
+    return iterations;
+}
+
+static size_t benchCommandFromView(size_t iterations) {
+    MessageView message;
+    parseMessage(PRIVMSG_LINE, strlen(PRIVMSG_LINE), message);
+    for (size_t i = 0; i < iterations; ++i) {
+        Command command(message);
+        sink = command.getParams().size();
+    }
+    return iterations;
+}
+
+// One op is one framed line; the chunk mixes CRLF and bare LF endings
+static size_t benchLineFraming(size_t iterations) {
+    std::string chunk;
+    size_t linesPerChunk = 0;
+    while (chunk.size() + 64 < LineBuffer::CAPACITY / 2) {
+        chunk += (linesPerChunk % 4) ? "PRIVMSG #general :line of moderate length\r\n"
+                                     : "PING :token\n";
+        ++linesPerChunk;
+    }
+    
+    LineBuffer input;
+    size_t lines = 0;
+    while (lines < iterations) {
+        size_t room;
+        char* buffer = input.prepareWrite(room);
+        memcpy(buffer, chunk.data(), chunk.size());
+        input.commit(chunk.size());
+        
+        StringRef line;
+        while (input.nextLine(line) == LineBuffer::LINE) {
+            sink = line.size;
+            ++lines;
+        }
+    }
+    return lines;
+}
+
+static size_t benchToUpper(size_t iterations) {
+    std::string command("privmsg");
+    for (size_t i = 0; i < iterations; ++i)
+        sink = toUpper(command).size();
+    return iterations;
+}
+
+static size_t benchIrcCaseFold(size_t iterations) {
+    std::string nickname("Alice[Away]");
+    for (size_t i = 0; i < iterations; ++i)
+        sink = ircCaseFold(nickname).size();
+    return iterations;
+}
+
+// The hostmask concatenation done by handlePrivmsg for every message
+static size_t benchPrefixBuilding(size_t iterations) {
+    std::string nickname("alice"), username("alice"), ip("127.0.0.1");
+    std::string target("#general"), text("hello there, how is everyone doing today?");
+    for (size_t i = 0; i < iterations; ++i) {
+        std::string prefix = ":" + nickname + "!" + username + "@" + ip;
+        std::string line = prefix + " PRIVMSG " + target + " :" + text;
+        sink = line.size();
+    }
+    return iterations;
+}
+
+// The same reply assembled from Client's cached prefix in one allocation
+static size_t benchCachedPrefix(size_t iterations) {
+    Client client(10, "127.0.0.1");
+    client.setNickname("alice");
+    client.setUsername("alice");
+    std::string target("#general"), text("hello there, how is everyone doing today?");
+    for (size_t i = 0; i < iterations; ++i) {
+        const std::string& prefix = client.getPrefix();
+        std::string line;
+        line.reserve(prefix.size() + target.size() + text.size() + 12);
+        line += prefix;
+        line += " PRIVMSG ";
+        line += target;
+        line += " :";
+        line += text;
+        sink = line.size();
+    }
+    return iterations;
+}
+
+// Connection churn: the Client itself comes from the slab pool
+static size_t benchClientChurn(size_t iterations) {
+    std::string ip("127.0.0.1");
+    for (size_t i = 0; i < iterations; ++i) {
+        Client* client = new Client(10, ip);
+        sink = client->getFd();
+        delete client;
+    }
+    return iterations;
+}
+
+// Swallows output so broadcast cost excludes socket writes
+class NullTransport : public Transport {
+public:
+    size_t delivered;
+    
+    NullTransport() : delivered(0) {}
+    void deliver(Client*, Payload*) { ++delivered; }
+    void disconnect(Client*, const std::string&) {}
+    void scheduleFlush(Client*) {}
+};
+
+// Channels are built once per size so setup stays out of the timing
+static Channel* channelWithMembers(size_t memberCount, NullTransport* transport) {
+    static std::vector<Channel*> channels;
+    for (size_t i = 0; i < channels.size(); ++i) {
+        if (channels[i]->getMemberCount() == memberCount) return channels[i];
+    }
+    
+    Channel* channel = new Channel("#general", new Client(10, "127.0.0.1", transport));
+    for (size_t i = 1; i < memberCount; ++i)
+        channel->addClient(new Client(static_cast<int>(i + 10), "127.0.0.1", transport));
+    channels.push_back(channel);
+    return channel;
+}
+
+static size_t benchBroadcast(size_t iterations, size_t memberCount) {
+    static NullTransport transport;
+    Channel* channel = channelWithMembers(memberCount, &transport);
+    Client* sender = channel->getMembers()[0].client;
+    
+    std::string line(PRIVMSG_LINE);
+    for (size_t i = 0; i < iterations; ++i)
+        channel->broadcast(line, sender);
+    sink = transport.delivered;
+    return iterations;
+}
+
+static size_t benchBroadcast10(size_t iterations) {
+    return benchBroadcast(iterations, 10);
+}
+
+static size_t benchBroadcast1000(size_t iterations) {
+    return benchBroadcast(iterations, 1000);
+}
+
+// NAMES for a 1000-member channel: rendered from scratch, then from the cache
+static size_t benchNamesRebuild(size_t iterations) {
+    static NullTransport transport;
+    Channel* channel = channelWithMembers(1000, &transport);
+    for (size_t i = 0; i < iterations; ++i) {
+        channel->invalidateNames();
+        sink = channel->getNames(450).size();
+    }
+    return iterations;
+}
+
+static size_t benchNamesCached(size_t iterations) {
+    static NullTransport transport;
+    Channel* channel = channelWithMembers(1000, &transport);
+    for (size_t i = 0; i < iterations; ++i)
+        sink = channel->getNames(450).size();
+    return iterations;
+}
+
+// Re-arming one keepalive among 100000 armed ones, as every idle check does
+static size_t benchTimerRearm(size_t iterations) {
+    static const size_t TIMERS = 100000;
+    static TimerWheel wheel(100, 0);
+    static Timer* timers = new Timer[TIMERS];
+    for (size_t i = 0; i < iterations; ++i)
+        wheel.schedule(&timers[i % TIMERS], 1000 + (i * 7919) % 3600000);
+    sink = wheel.size();
+    return iterations;
+}
+
+// Startup with 100000 saved channels: one op loads the whole state file
+static char storePath[] = "/tmp/ircbench-state.XXXXXX";
+
+static void removeStoreFile() {
+    unlink(storePath);
+}
+
+static size_t benchStoreLoad(size_t iterations) {
+    static bool written = false;
+    if (!written) {
+        close(mkstemp(storePath));
+        atexit(removeStoreFile);
+        
+        ChannelStore store;
+        store.open(storePath);
+        ChannelState state;
+        state.topic = "a topic of moderate length for the channel";
+        state.modes = STATE_TOPIC_RESTRICTED;
+        char name[32];
+        for (int i = 0; i < 100000; ++i) {
+            snprintf(name, sizeof(name), "#channel%d", i);
+            store.save(name, state);
+        }
+        store.flush();
+        written = true;
+    }
+    
+    for (size_t i = 0; i < iterations; ++i) {
+        ChannelStore store;
+        store.open(storePath);
+        sink = store.size();
+    }
+    return iterations;
+}
+
+struct Benchmark {
+    const char* name;
+    BenchFunction function;
+};
+
+static const Benchmark BENCHMARKS[] = {
+    {"parse/MessageView", benchParseView},
+    {"parse/Command(string)", benchCommandFromString},
+    {"parse/Command(view)", benchCommandFromView},
+    {"frame/LineBuffer", benchLineFraming},
+    {"case/toUpper", benchToUpper},
+    {"case/ircCaseFold", benchIrcCaseFold},
+    {"reply/hostmask+PRIVMSG", benchPrefixBuilding},
+    {"reply/cached-prefix", benchCachedPrefix},
+    {"alloc/Client", benchClientChurn},
+    {"fanout/broadcast-10", benchBroadcast10},
+    {"fanout/broadcast-1000", benchBroadcast1000},
+    {"names/rebuild-1000", benchNamesRebuild},
+    {"names/cached-1000", benchNamesCached},
+    {"timer/rearm-100k", benchTimerRearm},
+    {"store/load-100k", benchStoreLoad}
+};
+
+static double nowSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Doubles the iteration count until a run takes at least `minSeconds`
+static void run(const Benchmark& bench, double minSeconds) {
+    // One untimed op first, so one-off setup (the state file for
+    // store/load-100k) stays out of the results
+    bench.function(1);
+    
+    size_t iterations = 16;
+    for (;;) {
+        size_t allocationsBefore = allocations;
+        double start = nowSeconds();
+        size_t ops = bench.function(iterations);
+        double elapsed = nowSeconds() - start;
+        size_t allocated = allocations - allocationsBefore;
+        
+        if (elapsed >= minSeconds || iterations > (static_cast<size_t>(1) << 40)) {
+            std::cout << std::left << std::setw(26) << bench.name << std::right
+                      << std::setw(12) << std::fixed << std::setprecision(1) << elapsed * 1e9 / ops << " ns/op"
+                      << std::setw(10) << std::setprecision(2) << static_cast<double>(allocated) / ops << " allocs/op"
+                      << std::setw(14) << ops << " ops" << std::endl;
+            return;
+        }
+        iterations *= 2;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    const char* filter = NULL;
+    double minSeconds = 0.2;
+    
+    for (int i = 1; i < argc; ++i) {
+        std::string arg(argv[i]);
+        if (arg.compare(0, 7, "--time=") == 0) {
+            minSeconds = std::atof(arg.c_str() + 7);
+        } else if (arg.compare(0, 2, "--") != 0) {
+            filter = argv[i];
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [name-filter] [--time=seconds]" << std::endl;
+            return 1;
+        }
+    }
+    
+    // Keeps informational lines (the state file load) out of the results
+    Logger::start(Logger::LEVEL_WARN);
+    
+    for (size_t i = 0; i < sizeof(BENCHMARKS) / sizeof(BENCHMARKS[0]); ++i) {
+        if (!filter || strstr(BENCHMARKS[i].name, filter))
+            run(BENCHMARKS[i], minSeconds);
+    }
+    Logger::shutdown();
+    return 0;
+}
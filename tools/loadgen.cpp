@@ -0,0 +1,526 @@
+// Load generator for ircserv: opens N connections over loopback, registers
+// them, spreads them over a set of channels and drives PRIVMSG traffic at a
+// fixed rate. Each message carries its send time so delivery latency can be
+// measured end to end.
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <cmath>
+#include <ctime>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+struct Options {
+    std::string host;
+    int port;
+    std::string password;
+    size_t clients;
+    size_t channels;
+    size_t joins;           // channels joined per client
+    bool zipf;              // skew channel popularity instead of spreading evenly
+    double rate;            // PRIVMSG per second across all clients
+    double duration;        // seconds of traffic
+    size_t size;            // message body bytes
+    size_t connectBatch;    // connects in flight at once
+    
+    Options() : host("127.0.0.1"), port(6667), clients(100), channels(10), joins(1),
+                zipf(false), rate(1000), duration(10), size(64), connectBatch(256) {}
+};
+
+enum State {
+    CONNECTING,
+    REGISTERING,
+    JOINING,
+    READY,
+    FAILED
+};
+
+struct Connection {
+    int fd;
+    State state;
+    std::string input;
+    std::string output;
+    bool wantWrite;
+    std::vector<size_t> channels;
+    size_t joinsPending;
+    
+    Connection() : fd(-1), state(CONNECTING), wantWrite(false), joinsPending(0) {}
+};
+
+static double nowSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long long nowMicros() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<long long>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+static std::string channelName(size_t index) {
+    char name[32];
+    snprintf(name, sizeof(name), "#load%lu", static_cast<unsigned long>(index));
+    return name;
+}
+
+class LoadGenerator {
+private:
+    Options options;
+    int epollFd;
+    std::vector<Connection> connections;
+    std::vector<long long> latencies;
+    std::vector<size_t> channelMembers;
+    std::vector<double> zipfWeights;
+    
+    size_t connected;
+    size_t registered;
+    size_t joined;
+    size_t failed;
+    size_t sent;
+    size_t delivered;
+    size_t expected;
+    size_t bytesSent;
+    
+    LoadGenerator(const LoadGenerator&);
+    LoadGenerator& operator=(const LoadGenerator&);
+    
+    bool startConnect(size_t index);
+    void send(size_t index, const std::string& line);
+    void flush(size_t index);
+    void readFrom(size_t index);
+    void handleLine(size_t index, const std::string& line);
+    void fail(size_t index, const char* reason);
+    void chooseChannels(size_t index);
+    size_t pickChannel();
+    void poll(int timeoutMs);
+    size_t countState(State state) const;
+    
+public:
+    explicit LoadGenerator(const Options& options);
+    ~LoadGenerator();
+    
+    bool connectAll();
+    bool joinAll();
+    void drive();
+    void report() const;
+};
+
+LoadGenerator::LoadGenerator(const Options& options)
+    : options(options), epollFd(-1), connections(options.clients),
+      channelMembers(options.channels, 0), connected(0), registered(0), joined(0),
+      failed(0), sent(0), delivered(0), expected(0), bytesSent(0) {
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd < 0) {
+        perror("epoll_create1");
+        exit(1);
+    }
+    
+    // Zipf(1): channel k gets weight 1/(k+1)
+    double total = 0;
+    for (size_t i = 0; i < options.channels; ++i) {
+        total += 1.0 / (i + 1);
+        zipfWeights.push_back(total);
+    }
+    for (size_t i = 0; i < zipfWeights.size(); ++i)
+        zipfWeights[i] /= total;
+}
+
+LoadGenerator::~LoadGenerator() {
+    for (size_t i = 0; i < connections.size(); ++i) {
+        if (connections[i].fd >= 0) close(connections[i].fd);
+    }
+    if (epollFd >= 0) close(epollFd);
+}
+
+bool LoadGenerator::startConnect(size_t index) {
+    Connection& conn = connections[index];
+    conn.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (conn.fd < 0) {
+        perror("socket");
+        return false;
+    }
+    
+    int one = 1;
+    setsockopt(conn.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(options.port);
+    inet_pton(AF_INET, options.host.c_str(), &addr.sin_addr);
+    
+    if (connect(conn.fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0 &&
+        errno != EINPROGRESS) {
+        fail(index, strerror(errno));
+        return true;
+    }
+    
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT;
+    event.data.u64 = index;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, conn.fd, &event);
+    conn.wantWrite = true;
+    return true;
+}
+
+void LoadGenerator::send(size_t index, const std::string& line) {
+    Connection& conn = connections[index];
+    if (conn.state == FAILED) return;
+    conn.output += line;
+    conn.output += "\r\n";
+    if (conn.state != CONNECTING) flush(index);
+}
+
+void LoadGenerator::flush(size_t index) {
+    Connection& conn = connections[index];
+    while (!conn.output.empty()) {
+        ssize_t n = ::send(conn.fd, conn.output.data(), conn.output.size(), MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            fail(index, strerror(errno));
+            return;
+        }
+        bytesSent += n;
+        conn.output.erase(0, n);
+    }
+    
+    bool wantWrite = !conn.output.empty();
+    if (wantWrite != conn.wantWrite) {
+        struct epoll_event event;
+        event.events = wantWrite ? (EPOLLIN | EPOLLOUT) : static_cast<unsigned>(EPOLLIN);
+        event.data.u64 = index;
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, conn.fd, &event);
+        conn.wantWrite = wantWrite;
+    }
+}
+
+void LoadGenerator::fail(size_t index, const char* reason) {
+    Connection& conn = connections[index];
+    if (conn.state == FAILED) return;
+    
+    if (failed < 5)
+        std::cerr << "connection " << index << " failed: " << reason << std::endl;
+    conn.state = FAILED;
+    ++failed;
+    if (conn.fd >= 0) {
+        close(conn.fd);
+        conn.fd = -1;
+    }
+}
+
+void LoadGenerator::readFrom(size_t index) {
+    Connection& conn = connections[index];
+    char buffer[16384];
+    
+    for (;;) {
+        ssize_t n = recv(conn.fd, buffer, sizeof(buffer), 0);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) fail(index, strerror(errno));
+            break;
+        }
+        if (n == 0) {
+            fail(index, "closed by server");
+            break;
+        }
+        conn.input.append(buffer, n);
+        if (static_cast<size_t>(n) < sizeof(buffer)) break;
+    }
+    
+    size_t start = 0;
+    size_t newline;
+    while (conn.state != FAILED && (newline = conn.input.find('\n', start)) != std::string::npos) {
+        size_t end = newline;
+        if (end > start && conn.input[end - 1] == '\r') --end;
+        handleLine(index, conn.input.substr(start, end - start));
+        start = newline + 1;
+    }
+    if (conn.state != FAILED) conn.input.erase(0, start);
+}
+
+void LoadGenerator::handleLine(size_t index, const std::string& line) {
+    Connection& conn = connections[index];
+    
+    // ":prefix COMMAND ..." - look at the command word only
+    size_t space = line.find(' ');
+    if (space == std::string::npos) {
+        if (line.compare(0, 4, "PING") == 0) send(index, "PONG" + line.substr(4));
+        return;
+    }
+    size_t commandEnd = line.find(' ', space + 1);
+    std::string command = line.substr(space + 1, commandEnd == std::string::npos ? std::string::npos
+                                                                                  : commandEnd - space - 1);
+                                                                                  
+    if (line.compare(0, 5, "PING ") == 0) {
+        send(index, "PONG " + line.substr(5));
+    } else if (command == "PRIVMSG") {
+        size_t stamp = line.find(" :t=");
+        if (stamp != std::string::npos) {
+            long long sentAt = std::atoll(line.c_str() + stamp + 4);
+            latencies.push_back(nowMicros() - sentAt);
+            ++delivered;
+        }
+    } else if (command == "001" && conn.state == REGISTERING) {
+        conn.state = JOINING;
+        ++registered;
+    } else if (command == "JOIN" && conn.state == JOINING && conn.joinsPending > 0) {
+        // Our own JOIN echo; other members' joins arrive before ours completes
+        char nick[32];
+        snprintf(nick, sizeof(nick), ":load%lu!", static_cast<unsigned long>(index));
+        if (line.compare(0, strlen(nick), nick) == 0 && --conn.joinsPending == 0) {
+            conn.state = READY;
+            ++joined;
+        }
+    } else if (command == "433" || command == "464" || command == "ERROR" ||
+               command == "471" || command == "473" || command == "475") {
+        fail(index, line.c_str());
+    }
+}
+
+void LoadGenerator::poll(int timeoutMs) {
+    struct epoll_event events[256];
+    int count = epoll_wait(epollFd, events, 256, timeoutMs);
+    
+    for (int i = 0; i < count; ++i) {
+        size_t index = events[i].data.u64;
+        Connection& conn = connections[index];
+        if (conn.state == FAILED) continue;
+        
+        if (conn.state == CONNECTING && (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+            int error = 0;
+            socklen_t length = sizeof(error);
+            getsockopt(conn.fd, SOL_SOCKET, SO_ERROR, &error, &length);
+            if (error) {
+                fail(index, strerror(error));
+                continue;
+            }
+            conn.state = REGISTERING;
+            ++connected;
+        }
+        if (events[i].events & EPOLLIN) readFrom(index);
+        if (conn.state != FAILED && (events[i].events & EPOLLOUT)) flush(index);
+    }
+}
+
+size_t LoadGenerator::countState(State state) const {
+    size_t count = 0;
+    for (size_t i = 0; i < connections.size(); ++i) {
+        if (connections[i].state == state) ++count;
+    }
+    return count;
+}
+
+bool LoadGenerator::connectAll() {
+    double start = nowSeconds();
+    size_t next = 0;
+    
+    while (registered + failed < connections.size()) {
+        // Keep a bounded number of handshakes in flight so the listen
+        // backlog does not overflow
+        while (next < connections.size() && next - registered - failed < options.connectBatch) {
+            if (!startConnect(next)) return false;
+            char nick[32];
+            snprintf(nick, sizeof(nick), "load%lu", static_cast<unsigned long>(next));
+            send(next, "PASS " + options.password);
+            send(next, std::string("NICK ") + nick);
+            send(next, std::string("USER ") + nick + " 0 * :ircload");
+            ++next;
+        }
+        poll(100);
+        if (nowSeconds() - start > 60) {
+            std::cerr << "timed out waiting for registration" << std::endl;
+            break;
+        }
+    }
+    
+    double elapsed = nowSeconds() - start;
+    printf("connect:   %lu registered, %lu failed in %.3f s (%.0f conn/s)\n",
+           static_cast<unsigned long>(registered), static_cast<unsigned long>(failed),
+           elapsed, registered / elapsed);
+    return registered > 0;
+}
+
+size_t LoadGenerator::pickChannel() {
+    if (!options.zipf) return rand() % options.channels;
+    
+    double r = static_cast<double>(rand()) / RAND_MAX;
+    return std::lower_bound(zipfWeights.begin(), zipfWeights.end(), r) - zipfWeights.begin();
+}
+
+void LoadGenerator::chooseChannels(size_t index) {
+    Connection& conn = connections[index];
+    size_t wanted = std::min(options.joins, options.channels);
+    
+    // Uniform mode spreads clients round-robin so channel sizes stay equal
+    for (size_t k = 0; conn.channels.size() < wanted; ++k) {
+        size_t channel = options.zipf ? pickChannel() : (index * wanted + k) % options.channels;
+        if (std::find(conn.channels.begin(), conn.channels.end(), channel) == conn.channels.end())
+            conn.channels.push_back(channel);
+    }
+}
+
+bool LoadGenerator::joinAll() {
+    double start = nowSeconds();
+    
+    for (size_t i = 0; i < connections.size(); ++i) {
+        if (connections[i].state != JOINING) continue;
+        chooseChannels(i);
+        connections[i].joinsPending = connections[i].channels.size();
+        for (size_t k = 0; k < connections[i].channels.size(); ++k) {
+            send(i, "JOIN " + channelName(connections[i].channels[k]));
+            ++channelMembers[connections[i].channels[k]];
+        }
+    }
+    
+    while (countState(JOINING) > 0 && nowSeconds() - start < 60)
+        poll(100);
+        
+    size_t largest = *std::max_element(channelMembers.begin(), channelMembers.end());
+    printf("join:      %lu clients in %lu channels (largest %lu members) in %.3f s\n",
+           static_cast<unsigned long>(joined), static_cast<unsigned long>(options.channels),
+           static_cast<unsigned long>(largest), nowSeconds() - start);
+    return joined > 0;
+}
+
+void LoadGenerator::drive() {
+    std::vector<size_t> ready;
+    for (size_t i = 0; i < connections.size(); ++i) {
+        if (connections[i].state == READY) ready.push_back(i);
+    }
+    
+    std::string padding(options.size > 24 ? options.size - 24 : 0, 'x');
+    double start = nowSeconds();
+    double end = start + options.duration;
+    size_t sender = 0;
+    size_t skipped = 0;
+    size_t bytesBefore = bytesSent;
+    
+    for (double now = start; now < end; now = nowSeconds()) {
+        size_t due = static_cast<size_t>((now - start) * options.rate);
+        while (sent < due && skipped < ready.size()) {
+            size_t index = ready[sender++ % ready.size()];
+            Connection& conn = connections[index];
+            if (conn.state != READY) {
+                ++skipped;
+                continue;
+            }
+            skipped = 0;
+            
+            size_t channel = conn.channels[rand() % conn.channels.size()];
+            char stamp[32];
+            snprintf(stamp, sizeof(stamp), "%lld ", nowMicros());
+            send(index, "PRIVMSG " + channelName(channel) + " :t=" + stamp + padding);
+            expected += channelMembers[channel] - 1;
+            ++sent;
+        }
+        poll(1);
+    }
+    double sendElapsed = nowSeconds() - start;
+    
+    // Let messages still in flight arrive
+    double drainStart = nowSeconds();
+    while (delivered < expected && nowSeconds() - drainStart < 5)
+        poll(10);
+    double elapsed = nowSeconds() - start;
+    
+    printf("traffic:   %lu sent in %.3f s (%.0f msg/s, %.2f MB/s out)\n",
+           static_cast<unsigned long>(sent), sendElapsed, sent / sendElapsed,
+           (bytesSent - bytesBefore) / sendElapsed / 1e6);
+    printf("delivery:  %lu of %lu expected in %.3f s (%.0f msg/s)\n",
+           static_cast<unsigned long>(delivered), static_cast<unsigned long>(expected),
+           elapsed, delivered / elapsed);
+           
+    for (size_t i = 0; i < connections.size(); ++i) {
+        if (connections[i].state != FAILED) send(i, "QUIT :done");
+    }
+}
+
+void LoadGenerator::report() const {
+    if (latencies.empty()) {
+        printf("latency:   no messages delivered\n");
+        return;
+    }
+    
+    std::vector<long long> sorted(latencies);
+    std::sort(sorted.begin(), sorted.end());
+    
+    const double points[] = {50, 90, 99, 99.9};
+    printf("latency:  ");
+    for (size_t i = 0; i < sizeof(points) / sizeof(points[0]); ++i) {
+        size_t rank = static_cast<size_t>(std::ceil(points[i] / 100 * sorted.size()));
+        if (rank > 0) --rank;
+        printf(" p%g=%lldus", points[i], sorted[rank]);
+    }
+    printf(" max=%lldus\n", sorted.back());
+    if (failed)
+        printf("failures:  %lu connections\n", static_cast<unsigned long>(failed));
+}
+
+static bool parseOption(const std::string& arg, Options& options) {
+    size_t eq = arg.find('=');
+    if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos) return false;
+    
+    std::string name = arg.substr(2, eq - 2);
+    std::string value = arg.substr(eq + 1);
+    double number = std::atof(value.c_str());
+    
+    if (name == "clients") options.clients = static_cast<size_t>(number);
+    else if (name == "channels") options.channels = static_cast<size_t>(number);
+    else if (name == "joins") options.joins = static_cast<size_t>(number);
+    else if (name == "rate") options.rate = number;
+    else if (name == "duration") options.duration = number;
+    else if (name == "size") options.size = static_cast<size_t>(number);
+    else if (name == "batch") options.connectBatch = static_cast<size_t>(number);
+    else if (name == "host") options.host = value;
+    else if (name == "dist") {
+        if (value != "uniform" && value != "zipf") return false;
+        options.zipf = (value == "zipf");
+        return true;
+    } else return false;
+    return number > 0 || name == "host";
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " <port> <password> [--clients=N] [--channels=N] [--joins=N]"
+                  << " [--dist=uniform|zipf] [--rate=msg/s] [--duration=s] [--size=bytes]"
+                  << " [--batch=N] [--host=addr]" << std::endl;
+        return 1;
+    }
+    
+    Options options;
+    options.port = std::atoi(argv[1]);
+    options.password = argv[2];
+    for (int i = 3; i < argc; ++i) {
+        if (!parseOption(argv[i], options)) {
+            std::cerr << "Error: Invalid option " << argv[i] << std::endl;
+            return 1;
+        }
+    }
+    
+    // Each connection needs a descriptor
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < options.clients + 64) {
+        limit.rlim_cur = std::min<rlim_t>(limit.rlim_max, options.clients + 64);
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+    srand(42);
+    
+    LoadGenerator generator(options);
+    if (!generator.connectAll() || !generator.joinAll()) return 1;
+    generator.drive();
+    generator.report();
+    return 0;
+}
@@ -0,0 +1,259 @@
+// Regression checks for ircserv: starts ./ircserv on a loopback port, drives
+// it with plain blocking clients and compares the replies with what the
+// server must send. Exits non-zero when any check fails.
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <csignal>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+static const char PASSWORD[] = "regress";
+
+static int port = 16760;
+static int failures = 0;
+
+static void check(bool ok, const std::string& what) {
+    if (!ok) {
+        std::cout << "FAIL: " << what << std::endl;
+        ++failures;
+    }
+}
+
+// One registered user with a blocking socket and a short receive timeout
+class TestClient {
+private:
+    int fd;
+    
+    TestClient(const TestClient&);
+    TestClient& operator=(const TestClient&);
+    
+public:
+    explicit TestClient(const std::string& nick) : fd(-1) {
+        for (int attempt = 0; attempt < 50 && fd == -1; ++attempt) {
+            fd = socket(AF_INET, SOCK_STREAM, 0);
+            sockaddr_in addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(port);
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == -1) {
+                close(fd);
+                fd = -1;
+                usleep(20000);
+            }
+        }
+        if (fd == -1) {
+            std::cerr << "Cannot connect to port " << port << std::endl;
+            exit(1);
+        }
+        timeval timeout = {0, 200000};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        send(std::string("PASS ") + PASSWORD + "\r\nNICK " + nick + "\r\nUSER " + nick + " 0 * :" + nick + "\r\n");
+        read();
+    }
+    
+    ~TestClient() {
+        if (fd != -1)
+            close(fd);
+    }
+    
+    void send(const std::string& lines) {
+        ::send(fd, lines.data(), lines.size(), MSG_NOSIGNAL);
+    }
+    
+    // Everything that arrives until the server goes quiet
+    std::string read() {
+        std::string data;
+        char buffer[4096];
+        ssize_t n;
+        while ((n = recv(fd, buffer, sizeof(buffer), 0)) > 0)
+            data.append(buffer, n);
+        return data;
+    }
+    
+    // Blocks until `marker` has come in, for replies to a long burst
+    std::string readUntil(const std::string& marker) {
+        std::string data;
+        char buffer[65536];
+        for (int idle = 0; data.find(marker) == std::string::npos && idle < 25; ) {
+            ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+            if (n > 0) {
+                data.append(buffer, n);
+                idle = 0;
+            } else {
+                ++idle;
+            }
+        }
+        return data;
+    }
+    
+    void quit() {
+        send("QUIT :bye\r\n");
+        read();
+        close(fd);
+        fd = -1;
+    }
+};
+
+// An invite that was never used must go with the invited client, and not
+// pass to the next connection that reuses its Client slot
+static void inviteThenQuit() {
+    TestClient alice("alice");
+    alice.send("JOIN #c\r\nMODE #c +i\r\n");
+    alice.read();
+    
+    TestClient* bob = new TestClient("bob");
+    alice.send("INVITE bob #c\r\n");
+    alice.read();
+    bob->read();
+    bob->quit();
+    delete bob;
+    usleep(100000);
+    
+    TestClient mallory("mallory");
+    mallory.send("JOIN #c\r\n");
+    std::string reply = mallory.read();
+    check(reply.find(" 473 ") != std::string::npos, "invite-then-quit: JOIN after the invitee left got " + reply);
+}
+
+// Channel names are case-sensitive here while nicknames are not, so only
+// the nickname pair below is a duplicate
+static void privmsgDuplicates() {
+    TestClient alice("alice");
+    TestClient bob("bob");
+    TestClient carol("carol");
+    alice.send("JOIN #Foo\r\n");
+    bob.send("JOIN #foo\r\n");
+    alice.read();
+    bob.read();
+    
+    carol.send("JOIN #Foo,#foo\r\n");
+    carol.read();
+    alice.read();
+    bob.read();
+    
+    carol.send("PRIVMSG #Foo,#foo,alice,ALICE :hi\r\n");
+    std::string toAlice = alice.read();
+    std::string toBob = bob.read();
+    check(toAlice.find("PRIVMSG #Foo :hi") != std::string::npos, "privmsg: #Foo got " + toAlice);
+    check(toBob.find("PRIVMSG #foo :hi") != std::string::npos, "privmsg: #foo got nothing: " + toBob);
+    
+    size_t direct = 0;
+    for (size_t at = 0; (at = toAlice.find("PRIVMSG alice :hi", at)) != std::string::npos; ++at)
+        ++direct;
+    check(direct + (toAlice.find("PRIVMSG ALICE :hi") != std::string::npos) == 1,
+          "privmsg: alice,ALICE should arrive once, got " + toAlice);
+}
+
+static std::string binary = "./ircserv";
+
+static pid_t startServer(const std::vector<std::string>& options) {
+    char portArg[16];
+    snprintf(portArg, sizeof(portArg), "%d", port);
+    std::vector<std::string> args;
+    args.push_back(binary);
+    args.push_back(portArg);
+    args.push_back(PASSWORD);
+    args.push_back("--log-level=error");
+    args.insert(args.end(), options.begin(), options.end());
+    
+    pid_t server = fork();
+    if (server == 0) {
+        std::vector<char*> argv;
+        for (size_t i = 0; i < args.size(); ++i)
+            argv.push_back(const_cast<char*>(args[i].c_str()));
+        argv.push_back(NULL);
+        execv(binary.c_str(), &argv[0]);
+        std::cerr << "Cannot run " << binary << std::endl;
+        _exit(127);
+    }
+    return server;
+}
+
+static void stopServer(pid_t server) {
+    kill(server, SIGINT);
+    waitpid(server, NULL, 0);
+}
+
+static off_t fileSize(const std::string& path) {
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 ? info.st_size : -1;
+}
+
+// The state file is compacted more than once in a run, and what is left
+// still loads: the rewritten journal must stay readable for the next pass
+static void compactThenReload() {
+    char path[] = "/tmp/ircregress-state.XXXXXX";
+    close(mkstemp(path));
+    std::vector<std::string> options;
+    options.push_back(std::string("--state-file=") + path);
+    options.push_back("--flood-rate=0");
+    
+    pid_t server = startServer(options);
+    off_t firstBatch = 0;
+    {
+        TestClient alice("alice");
+        alice.send("JOIN #s\r\n");
+        alice.read();
+        
+        // Compaction starts past 10000 stale records, so this is room for three
+        char line[64];
+        for (int batch = 0; batch < 35; ++batch) {
+            std::string lines;
+            for (int i = 0; i < 1000; ++i) {
+                snprintf(line, sizeof(line), "TOPIC #s :topic %02d%03d\r\n", batch, i);
+                lines += line;
+            }
+            snprintf(line, sizeof(line), "PING :batch%02d\r\n", batch);
+            lines += line;
+            alice.send(lines);
+            alice.readUntil(std::string(line).substr(6, 7));
+            if (batch == 0) {
+                usleep(300000);
+                firstBatch = fileSize(path);
+            }
+        }
+        alice.send("TOPIC #s :final\r\n");
+        alice.read();
+    }
+    stopServer(server);
+    
+    // One batch is about 1000 records; without the later compactions the
+    // file keeps 25000
+    off_t size = fileSize(path);
+    check(size > 0 && size < 15 * firstBatch, "compaction: state file is still large after 35000 updates");
+    
+    server = startServer(options);
+    {
+        TestClient bob("bob");
+        bob.send("JOIN #s\r\n");
+        std::string reply = bob.read();
+        check(reply.find(" 332 bob #s :final") != std::string::npos, "compaction: topic after reload got " + reply);
+    }
+    stopServer(server);
+    unlink(path);
+    unlink((std::string(path) + ".tmp").c_str());
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1)
+        binary = argv[1];
+    
+    pid_t server = startServer(std::vector<std::string>());
+    inviteThenQuit();
+    privmsgDuplicates();
+    stopServer(server);
+    
+    compactThenReload();
+    std::cout << (failures ? "regress: FAILED" : "regress: OK") << std::endl;
+    return failures ? 1 : 0;
+}